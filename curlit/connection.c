@@ -0,0 +1,183 @@
+/* connection.c: Non-blocking persistent HTTP connection */
+
+#include "curlit.h"
+#include "socket.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Connection Functions */
+
+/**
+ * Initialize closed connection.
+ * @param   c           Pointer to Connection structure
+ **/
+void    connection_init(Connection *c) {
+    *c = (Connection){
+        .fd     = -1,
+        .buffer = malloc(CONNECTION_BUFFER),
+        .output = malloc(PIPELINE_DEPTH * (PATH_MAX + NI_MAXHOST + VALIDATOR_MAX + 128)),
+    };
+}
+
+/**
+ * Start connecting to host at the first address from address on that
+ * accepts a socket, and watch for the connection with epoll.
+ * @param   c           Pointer to Connection structure
+ * @param   epoll       epoll instance
+ * @param   host        Pointer to Host structure
+ * @param   address     First address to try
+ * @return  true if a connection is in progress.
+ **/
+bool    connection_open(Connection *c, int epoll, const Host *host, const struct addrinfo *address) {
+    if(c->fd >= 0) close(c->fd);
+
+    c->host       = host;
+    c->fd         = -1;
+    c->start      = c->end = 0;
+    c->sent       = 0;
+    c->answered   = 0;
+    c->connecting = true;
+    response_init(&c->response);
+
+    for(c->address = address; c->address; c->address = c->address->ai_next){
+        if((c->fd = socket_connect(c->address)) >= 0) break;
+    }
+    if(c->fd < 0){
+        return false;
+    }
+
+    struct epoll_event event = {.events = EPOLLOUT, .data.ptr = c};
+    c->events = event.events;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, c->fd, &event);
+    return true;
+}
+
+/**
+ * Finish non-blocking connect.
+ * @param   c           Pointer to Connection structure
+ * @return  true if the connection was established.
+ **/
+bool    connection_connected(Connection *c) {
+    int       error  = 0;
+    socklen_t length = sizeof(error);
+
+    if(getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error){
+        return false;
+    }
+
+    c->connecting = false;
+    return true;
+}
+
+/**
+ * Close connection (it may be opened again), dropping unread bytes and
+ * unsent requests; queued transfers are left to the caller.
+ * @param   c           Pointer to Connection structure
+ **/
+void    connection_close(Connection *c) {
+    if(c->fd >= 0) close(c->fd);
+    c->host       = NULL;
+    c->fd         = -1;
+    c->connecting = false;
+    c->start      = c->end = 0;
+    c->sent       = c->noutput = 0;
+    c->first      = c->count = 0;
+}
+
+/**
+ * Close connection and deallocate buffers.
+ * @param   c           Pointer to Connection structure
+ **/
+void    connection_delete(Connection *c) {
+    connection_close(c);
+    free(c->buffer);
+    free(c->output);
+}
+
+/**
+ * Add request of transfer to the requests to send.
+ * @param   c           Pointer to Connection structure
+ * @param   t           Pointer to Transfer structure
+ **/
+void    connection_request(Connection *c, const Transfer *t) {
+    if(c->sent == c->noutput) c->sent = c->noutput = 0;
+
+    char *p = c->output + c->noutput;
+    p += sprintf(p, "%s /%s HTTP/1.1\r\nHost: %s\r\n", t->head ? "HEAD" : "GET", t->url->path, t->url->host);
+    if(t->ranged){
+        p += sprintf(p, "Range: bytes=%" PRIu64 "-%" PRIu64 "\r\n", t->first, t->last);
+        if(*t->validator) p += sprintf(p, "If-Range: %s\r\n", t->validator);
+    }
+    p += sprintf(p, "\r\n");
+    c->noutput = p - c->output;
+}
+
+/**
+ * Send as much of the pending requests as the socket takes.
+ * @param   c           Pointer to Connection structure
+ * @return  false if the connection failed.
+ **/
+bool    connection_flush(Connection *c) {
+    while(c->sent < c->noutput){
+        ssize_t nwritten = send(c->fd, c->output + c->sent, c->noutput - c->sent, MSG_NOSIGNAL);
+        if(nwritten < 0){
+            if(errno == EINTR) continue;
+            return errno == EAGAIN;
+        }
+        c->sent += nwritten;
+    }
+    return true;
+}
+
+/**
+ * Receive bytes after those buffered, moving unparsed bytes to the front of
+ * the buffer first if it is full.
+ * @param   c           Pointer to Connection structure
+ * @return  false at end of stream or on error.
+ **/
+bool    connection_receive(Connection *c) {
+    if(c->start == c->end){
+        c->start = c->end = 0;
+    }
+    else if(c->end == CONNECTION_BUFFER){
+        memmove(c->buffer, c->buffer + c->start, c->end - c->start);
+        c->end  -= c->start;
+        c->start = 0;
+    }
+
+    ssize_t nread;
+    while((nread = recv(c->fd, c->buffer + c->end, CONNECTION_BUFFER - c->end, 0)) < 0 && errno == EINTR);
+    if(nread < 0){
+        return errno == EAGAIN;
+    }
+
+    c->end += nread;
+    return nread > 0;
+}
+
+/**
+ * Watch connection for what it waits on: the connect, or responses and the
+ * room to send pending requests.
+ * @param   c           Pointer to Connection structure
+ * @param   epoll       epoll instance
+ **/
+void    connection_watch(Connection *c, int epoll) {
+    struct epoll_event event = {
+        .events   = c->connecting ? EPOLLOUT : EPOLLIN | (c->sent < c->noutput ? EPOLLOUT : 0),
+        .data.ptr = c,
+    };
+
+    if(c->fd >= 0 && event.events != c->events){
+        c->events = event.events;
+        epoll_ctl(epoll, EPOLL_CTL_MOD, c->fd, &event);
+    }
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
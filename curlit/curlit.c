@@ -1,16 +1,15 @@
 /* curlit.c Simple HTTP client*/
 
 
-#include "socket.h"
+#include "curlit.h"
 
-#include <limits.h>
-#include <stdbool.h>
-#include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 /* Constants */
 
@@ -20,18 +19,6 @@
 #define BILLION         (1000000000.0)
 #define MEGABYTES       (1<<20)
 
-/* Macros */
-
-#define streq(a, b) (strcmp(a, b) == 0)
-
-/* Structures */
-
-typedef struct {
-    char host[NI_MAXHOST];
-    char port[NI_MAXSERV];
-    char path[PATH_MAX];
-} URL;
-
 /* Functions */
 
 /**
@@ -39,7 +26,13 @@ typedef struct {
  * @param   status      Exit status.
  **/
 void    usage(int status) {
-    fprintf(stderr, "Usage: curlit [-h] URL\n");
+    fprintf(stderr, "Usage: curlit [-h] [-P N] [-m SECONDS] [-o FILE] URL...\n");
+    fprintf(stderr, "       curlit [-h] [-m SECONDS] -segments N -o FILE URL\n\n");
+    fprintf(stderr, "    -P N         Fetch over up to N connections at once (default 1)\n");
+    fprintf(stderr, "    -m SECONDS   Give up on a response after SECONDS without data (default 30)\n");
+    fprintf(stderr, "    -o FILE      Write bodies to FILE instead of standard out\n");
+    fprintf(stderr, "    -segments N  Fetch URL into FILE as N byte ranges at once, resuming\n");
+    fprintf(stderr, "                 an interrupted download\n");
     exit(status);
 }
 
@@ -90,80 +83,42 @@ void    parse_url(const char *s, URL *url) {
 }
 
 /**
- * Fetch contents of URL and print to standard out.
+ * Fetch contents of URLs and write them to output in order. Up to
+ * parallel connections run at once; requests to the same host and port are
+ * pipelined on persistent connections.
  *
- * Print elapsed time and bandwidth to standard error.
- * @param   s       URL string
- * @param   url     Pointer to URL structure
- * @return  true if client is able to read all of the content (or if the
- * content length is unset), otherwise false
+ * Print a summary of each URL to standard error.
+ * @param   urls        Array of URL structures
+ * @param   nurls       Number of URLs
+ * @param   parallel    Maximum number of connections at once
+ * @param   timeout     Seconds a response may go without bytes
+ * @param   output      File descriptor to write bodies to
+ * @param   total       Pointer to number of body bytes received
+ * @return  true if every response was successful and complete, otherwise
+ * false
  **/
-bool    fetch_url(URL *url) {
-    bool return_val = true;
-    
-    // Grab start time
-    struct timespec start_time;
-    clock_gettime(CLOCK_MONOTONIC, &start_time);
-    
-    // Connect to remote host and port
-    FILE *client_socket = socket_dial(url->host, url->port);
-    if(!client_socket){
-        return false;
-    }
-    
-    // Send request to server
-    fprintf(client_socket, "GET /%s HTTP/1.0\r\n", url->path);
-    fprintf(client_socket, "Host: %s\r\n", url->host);
-    fprintf(client_socket, "\r\n");
-    
-    // Read status response from server
-    char buffer[BUFSIZ];
-    fgets(buffer, BUFSIZ, client_socket);
-
-    if(strstr(buffer, "200 OK") == NULL){
-        return_val = false;
-    }
-
-    // Read response headers from server
-    int content_length = 0;
-    
-    while((fgets(buffer, BUFSIZ, client_socket)) && strlen(buffer) > 2){
-        sscanf(buffer, "Content-Length: %d", &content_length);
-    }
+bool    fetch_urls(const URL *urls, size_t nurls, size_t parallel, double timeout, int output, uint64_t *total) {
+    Engine engine;
+    bool return_val = engine_init(&engine, urls, nurls, parallel, timeout, output) && engine_run(&engine);
+    *total = engine.total;
     
-    // Read response body from server
-    size_t nread = 0;
-    size_t total_bytes = 0;
-    while((nread = fread(buffer, 1, BUFSIZ, client_socket)) > 0){
-        fwrite(buffer, 1, nread, stdout);
-        total_bytes += nread;
-    }
+    engine_report(&engine);
+    engine_delete(&engine);
     
-    // Grab end time
-    struct timespec end_time;
-    clock_gettime(CLOCK_MONOTONIC, &end_time);
-    double elapsed_time = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / BILLION;
-    double bandwidth = total_bytes / (MEGABYTES*elapsed_time);
-    
-    // Output metrics
-    fprintf(stderr, "Time Elapsed: %0.2f s\n", elapsed_time);
-    fprintf(stderr, "Bandwidth: %0.2f MB/s\n", bandwidth);
-    
-    fclose(client_socket);
-    
-    if((return_val == false) || ((content_length != 0) && (content_length != total_bytes))){
-        return false;
-    }
-    
-    return true;
+    return return_val;
 }
 
 /* Main Execution */
 
 int     main(int argc, char *argv[]) {
     // Parse command line options
-    URL url;
-    char *user_url;
+    URL *urls = calloc(argc, sizeof(URL));
+    size_t nurls = 0;
+    long parallel = 1;
+    double timeout = REQUEST_TIMEOUT;
+    long segments = 0;
+    const char *path = NULL;
+    int output = STDOUT_FILENO;
     
     if(argc == 1){
         usage(1);
@@ -173,23 +128,72 @@ int     main(int argc, char *argv[]) {
         if(strcmp(argv[i], "-h") == 0){
             usage(0);
         }
+        else if(streq(argv[i], "-P") && i + 1 < argc){
+            parallel = strtol(argv[++i], NULL, 10);
+            if(parallel < 1) usage(1);
+        }
+        else if(streq(argv[i], "-m") && i + 1 < argc){
+            timeout = strtod(argv[++i], NULL);
+            if(timeout <= 0) usage(1);
+        }
+        else if(streq(argv[i], "-segments") && i + 1 < argc){
+            segments = strtol(argv[++i], NULL, 10);
+            if(segments < 1) usage(1);
+        }
+        else if(streq(argv[i], "-o") && i + 1 < argc){
+            path = argv[++i];
+        }
         else if(argv[i][0] == '-'){
             usage(1);
         }
         else{
-            user_url = argv[i];
+            // Parse URL
+            parse_url(argv[i], &urls[nurls++]);
         }
     }
     
-    // Parse URL
-    parse_url(user_url, &url);
+    if(nurls == 0 || (segments && (nurls != 1 || !path))){
+        usage(1);
+    }
 
-    //  Fetch URL
-    if(!fetch_url(&url)){
+    // Grab start time
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    uint64_t total_bytes = 0;
+    bool success;
+
+    if(segments){
+        // Fetch URL in ranges straight into the file
+        success = segment_fetch(&urls[0], path, segments, timeout, &total_bytes);
+        free(urls);
+    }
+    else if(path && (output = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0){
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        free(urls);
         return EXIT_FAILURE;
     }
+    else{
+        //  Fetch URLs
+        success = fetch_urls(urls, nurls, parallel, timeout, output, &total_bytes);
+        free(urls);
+
+        if(path && close(output) < 0){
+            fprintf(stderr, "Unable to close %s: %s\n", path, strerror(errno));
+            success = false;
+        }
+    }
+
+    // Grab end time
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double elapsed_time = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / BILLION;
+    double bandwidth = total_bytes / (MEGABYTES*elapsed_time);
+    
+    // Output metrics
+    fprintf(stderr, "Time Elapsed: %0.2f s\n", elapsed_time);
+    fprintf(stderr, "Bandwidth: %0.2f MB/s\n", bandwidth);
 
-    return EXIT_SUCCESS;
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 /* vim set sts=4 sw=4 ts=8 expandtab ft=c */
\ No newline at end of file
@@ -0,0 +1,175 @@
+/* curlit.h: Simple HTTP client */
+
+#pragma once
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <netdb.h>
+
+/* Constants */
+
+#define CONNECTION_BUFFER   (1<<16)     // Bytes received at once
+#define PIPELINE_DEPTH      32          // Requests sent at once per connection
+#define REQUEST_TIMEOUT     30.0        // Default seconds to wait for a response
+#define SPLICE_PIPE         (1<<20)     // Bytes spliced through the pipe at once
+#define VALIDATOR_MAX       128         // Bytes of ETag or Last-Modified kept
+
+/* Macros */
+
+#define streq(a, b) (strcmp(a, b) == 0)
+
+/* URL Structure */
+
+typedef struct {
+    char host[NI_MAXHOST];
+    char port[NI_MAXSERV];
+    char path[PATH_MAX];
+} URL;
+
+/* Host Structure */
+
+typedef struct {
+    const URL       *url;       // First URL naming host and port
+    struct addrinfo *addresses; // Resolved addresses (NULL if unresolved)
+    bool             resolved;  // Whether lookup was done
+} Host;
+
+/* Response Structure */
+
+typedef enum {
+    RESPONSE_STATUS,        // Reading status line
+    RESPONSE_HEADERS,       // Reading header lines
+    RESPONSE_BODY,          // Reading body of known length
+    RESPONSE_CHUNK_SIZE,    // Reading size line of chunk
+    RESPONSE_CHUNK_DATA,    // Reading data of chunk
+    RESPONSE_CHUNK_END,     // Reading CRLF after chunk data
+    RESPONSE_TRAILERS,      // Reading trailer lines after last chunk
+    RESPONSE_UNTIL_CLOSE,   // Reading body until end of stream
+    RESPONSE_DONE,          // Response complete
+    RESPONSE_ERROR,         // Response malformed
+} ResponseState;
+
+typedef struct {
+    ResponseState   state;
+    int             status;     // Status code
+    int             minor;      // Minor HTTP version
+    uint64_t        length;     // Content-Length, then bytes left of body
+                                // or chunk
+    bool            has_length; // Whether Content-Length was given
+    bool            encoded;    // Whether Transfer-Encoding was given
+    bool            chunked;    // Whether the final coding is chunked
+    bool            closing;    // Whether server closes after response
+    bool            head;       // Whether response is to HEAD (no body)
+    bool            ranges;     // Whether Accept-Ranges includes bytes
+    bool            has_range;  // Whether Content-Range was given
+    uint64_t        range_first;// First byte of Content-Range
+    uint64_t        range_last; // Last byte of Content-Range
+    uint64_t        range_total;// Size of whole body in Content-Range
+    char            etag[VALIDATOR_MAX];     // ETag ("" if none or too long)
+    char            modified[VALIDATOR_MAX]; // Last-Modified ("" if none)
+    const char     *error;      // Why response is malformed or short
+} Response;
+
+void    response_init(Response *r);
+size_t  response_parse(Response *r, const char *data, size_t n, const char **body, size_t *nbody);
+uint64_t response_pending(const Response *r);
+void    response_advance(Response *r, size_t n);
+bool    response_finish(Response *r);
+
+/* Transfer Structure */
+
+typedef struct {
+    const URL  *url;        // URL requested
+    Host       *host;       // Host of URL
+    bool        head;       // Whether to send HEAD instead of GET
+    bool        ranged;     // Whether to request bytes first to last,
+                            // written to the output at their offsets
+    uint64_t    first;      // First byte of range
+    uint64_t    last;       // Last byte of range
+    uint64_t    size;       // Content-Length of HEAD, or size of whole
+                            // body expected for a range (UINT64_MAX if
+                            // unknown)
+    bool        ranges;     // Whether HEAD response accepts byte ranges
+    char        validator[VALIDATOR_MAX];   // Strong ETag, else Last-Modified,
+                            // found by HEAD or sent as If-Range with a
+                            // range ("" if none)
+    bool        assigned;   // Whether request is queued on a connection
+    bool        done;       // Whether transfer is finished
+    int         status;     // Status code (0 if no response)
+    uint64_t    bytes;      // Body bytes received
+    double      start;      // Time request was queued
+    double      elapsed;    // Seconds from queueing to finishing
+    const char *error;      // Reason transfer failed (NULL if it did not)
+    int         spool;      // Temporary file of body received before its
+                            // turn to be printed (-1 if none)
+} Transfer;
+
+/* Connection Structure */
+
+typedef struct {
+    const Host             *host;       // Remote host (NULL if closed)
+    const struct addrinfo  *address;    // Address being connected to
+    int         fd;                     // Socket (-1 if closed)
+    bool        connecting;             // Whether connect is in progress
+    uint32_t    events;                 // epoll events watched
+    char       *buffer;                 // Bytes received and not yet parsed
+    size_t      start;                  // Offset of first unparsed byte
+    size_t      end;                    // Offset past last byte received
+    char       *output;                 // Requests not yet sent
+    size_t      sent;                   // Bytes of output sent
+    size_t      noutput;                // Bytes of output
+    size_t      queue[PIPELINE_DEPTH];  // Transfers awaiting responses
+    size_t      first;                  // Index of first queued transfer
+    size_t      count;                  // Number of queued transfers
+    size_t      answered;               // Responses read since connecting
+    double      deadline;               // Time by which more bytes must arrive
+    Response    response;               // Response being read
+} Connection;
+
+void    connection_init(Connection *c);
+bool    connection_open(Connection *c, int epoll, const Host *host, const struct addrinfo *address);
+bool    connection_connected(Connection *c);
+void    connection_close(Connection *c);
+void    connection_delete(Connection *c);
+void    connection_request(Connection *c, const Transfer *t);
+bool    connection_flush(Connection *c);
+bool    connection_receive(Connection *c);
+void    connection_watch(Connection *c, int epoll);
+
+/* Engine Structure */
+
+typedef struct {
+    int         epoll;          // epoll instance
+    int         output;         // File descriptor bodies are written to
+    int         pipe[2];        // Pipe bodies are spliced through
+    size_t      npipe;          // Capacity of pipe
+    bool        splice;         // Whether bodies may be spliced to output
+    Transfer   *transfers;      // Transfers in printing order
+    size_t      ntransfers;     // Number of transfers
+    Connection *connections;    // Connection slots
+    size_t      nconnections;   // Number of connection slots (-P)
+    Host       *hosts;          // Distinct hosts and ports
+    size_t      nhosts;         // Number of hosts
+    size_t      pending;        // First transfer that may be unassigned
+    size_t      unassigned;     // Number of transfers not yet queued
+    size_t      finished;       // Number of transfers finished
+    size_t      cursor;         // Next transfer to print
+    double      timeout;        // Seconds a response may go without bytes
+    uint64_t    total;          // Body bytes received
+} Engine;
+
+bool    engine_init(Engine *e, const URL *urls, size_t nurls, size_t parallel, double timeout, int output);
+bool    engine_run(Engine *e);
+void    engine_report(const Engine *e);
+void    engine_delete(Engine *e);
+void    engine_stop(int signum);
+
+/* Segment Functions */
+
+bool    segment_fetch(const URL *url, const char *path, size_t nsegments, double timeout, uint64_t *total);
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
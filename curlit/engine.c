@@ -0,0 +1,667 @@
+/* engine.c: Concurrent fetches on non-blocking connections with epoll */
+
+#define _GNU_SOURCE  // splice, O_TMPFILE, F_SETPIPE_SZ
+
+#include "curlit.h"
+#include "socket.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define ENGINE_EVENTS   256     // Events taken per epoll_wait
+
+/* Globals */
+
+static volatile sig_atomic_t EngineStop = 0;    // Set by engine_stop
+
+/* Internal Functions */
+
+/**
+ * Current time.
+ * @return  Seconds on the monotonic clock.
+ **/
+static double engine_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Write all of data to file descriptor (exits on failure).
+ * @param   fd          File descriptor
+ * @param   data        Bytes to write
+ * @param   n           Number of bytes
+ **/
+static void engine_write(int fd, const char *data, size_t n) {
+    while(n){
+        ssize_t nwritten = write(fd, data, n);
+        if(nwritten < 0){
+            if(errno == EINTR) continue;
+            fprintf(stderr, "Unable to write: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        data += nwritten;
+        n    -= nwritten;
+    }
+}
+
+/**
+ * Write all of data to file descriptor at offset (exits on failure).
+ * @param   fd          File descriptor
+ * @param   data        Bytes to write
+ * @param   n           Number of bytes
+ * @param   offset      Offset in file
+ **/
+static void engine_pwrite(int fd, const char *data, size_t n, uint64_t offset) {
+    while(n){
+        ssize_t nwritten = pwrite(fd, data, n, offset);
+        if(nwritten < 0){
+            if(errno == EINTR) continue;
+            fprintf(stderr, "Unable to write: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        data   += nwritten;
+        n      -= nwritten;
+        offset += nwritten;
+    }
+}
+
+/**
+ * File descriptor body bytes of transfer go to: the output if it is the
+ * transfer at the cursor, otherwise its spool (an unnamed temporary file
+ * made on first use).
+ * @param   e           Pointer to Engine structure
+ * @param   t           Pointer to Transfer structure
+ * @return  File descriptor.
+ **/
+static int engine_sink(Engine *e, Transfer *t) {
+    if(t == &e->transfers[e->cursor]){
+        return e->output;
+    }
+
+    if(t->spool < 0 && (t->spool = open(P_tmpdir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600)) < 0){
+        fprintf(stderr, "Unable to make spool: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return t->spool;
+}
+
+/**
+ * Print bodies whose turn has come, in order: the spool of the transfer at
+ * the cursor is copied out in the kernel, and the cursor moves past
+ * finished ones.
+ * @param   e           Pointer to Engine structure
+ **/
+static void engine_advance(Engine *e) {
+    while(e->cursor < e->ntransfers){
+        Transfer *t = &e->transfers[e->cursor];
+
+        if(t->spool >= 0){
+            off_t   offset = 0;
+            ssize_t nsent;
+            while((nsent = sendfile(e->output, t->spool, &offset, SPLICE_PIPE)) > 0 || (nsent < 0 && errno == EINTR));
+
+            // Outputs sendfile cannot write to are copied by hand
+            char    buffer[BUFSIZ];
+            ssize_t nread;
+            while(nsent < 0 && (nread = pread(t->spool, buffer, BUFSIZ, offset)) > 0){
+                engine_write(e->output, buffer, nread);
+                offset += nread;
+            }
+
+            close(t->spool);
+            t->spool = -1;
+        }
+
+        if(!t->done) break;
+        e->cursor++;
+    }
+}
+
+/**
+ * Write body bytes of transfer that follow the first skip bytes not yet
+ * counted: a range goes straight to its offset in the output, anything else
+ * to its sink.
+ * @param   e           Pointer to Engine structure
+ * @param   t           Pointer to Transfer structure
+ * @param   data        Body bytes
+ * @param   n           Number of bytes
+ * @param   skip        Bytes received before data but not yet counted
+ **/
+static void engine_store(Engine *e, Transfer *t, const char *data, size_t n, uint64_t skip) {
+    if(t->ranged){
+        engine_pwrite(e->output, data, n, t->first + t->bytes + skip);
+    }
+    else{
+        engine_write(engine_sink(e, t), data, n);
+    }
+}
+
+/**
+ * Take body bytes of transfer from the receive buffer.
+ * @param   e           Pointer to Engine structure
+ * @param   t           Pointer to Transfer structure
+ * @param   data        Body bytes
+ * @param   n           Number of bytes
+ **/
+static void engine_body(Engine *e, Transfer *t, const char *data, size_t n) {
+    engine_store(e, t, data, n, 0);
+    t->bytes += n;
+    e->total += n;
+}
+
+/**
+ * Move body bytes of the response at the front of connection from the
+ * socket to where they go through a pipe, so they are never copied to user
+ * space (ranges are spliced to their offset in the output). This applies
+ * while nothing is left in the receive buffer and the response is in the
+ * middle of its body.
+ * @param   e           Pointer to Engine structure
+ * @param   c           Pointer to Connection structure
+ * @param   open        Pointer to whether the connection is still open
+ * @return  false if bytes must be received and parsed instead.
+ **/
+static bool engine_splice(Engine *e, Connection *c, bool *open) {
+    size_t pending = response_pending(&c->response);
+    if(!e->splice || !c->count || c->start < c->end || !pending){
+        return false;
+    }
+
+    Transfer *t      = &e->transfers[c->queue[c->first]];
+    int       sink   = t->ranged ? e->output : engine_sink(e, t);
+    loff_t    offset = t->first + t->bytes;
+    ssize_t   n    = splice(c->fd, NULL, e->pipe[1], NULL, pending < e->npipe ? pending : e->npipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    if(n < 0 && errno != EAGAIN && errno != EINTR){
+        // Sockets that cannot be spliced are read instead
+        e->splice = false;
+        return false;
+    }
+    *open = n != 0;
+    if(n <= 0) return true;
+
+    for(ssize_t moved = 0, m; moved < n; moved += m){
+        if((m = splice(e->pipe[0], NULL, sink, t->ranged ? &offset : NULL, n - moved, SPLICE_F_MOVE)) > 0) continue;
+        if(m < 0 && errno == EINTR){
+            m = 0;
+            continue;
+        }
+
+        // Outputs splice cannot write to (such as terminals) get the rest
+        // of the pipe by hand, and later bodies by receiving
+        e->splice = false;
+        while(moved < n && (m = read(e->pipe[0], c->buffer, CONNECTION_BUFFER)) > 0){
+            engine_store(e, t, c->buffer, m, moved);
+            moved += m;
+        }
+        break;
+    }
+
+    t->bytes += n;
+    e->total += n;
+    response_advance(&c->response, n);
+    return true;
+}
+
+/**
+ * Finish transfer.
+ * @param   e           Pointer to Engine structure
+ * @param   t           Pointer to Transfer structure
+ * @param   error       Reason transfer failed (NULL if it did not)
+ **/
+static void engine_finish(Engine *e, Transfer *t, const char *error) {
+    t->done    = true;
+    t->error   = error;
+    t->elapsed = engine_now() - t->start;
+    e->finished++;
+    engine_advance(e);
+}
+
+/**
+ * Finish transfer at the front of the queue of connection, whose response
+ * is complete, and start parsing the next response.
+ * @param   e           Pointer to Engine structure
+ * @param   c           Pointer to Connection structure
+ **/
+static void engine_complete(Engine *e, Connection *c) {
+    Transfer *t = &e->transfers[c->queue[c->first]];
+
+    t->status = c->response.status;
+    if(t->head){
+        t->size   = c->response.has_length && !c->response.encoded ? c->response.length : UINT64_MAX;
+        t->ranges = c->response.ranges;
+
+        // Weak ETags do not promise the same bytes
+        const char *etag = c->response.etag;
+        strcpy(t->validator, *etag && strncmp(etag, "W/", 2) != 0 ? etag : c->response.modified);
+    }
+    engine_finish(e, t, NULL);
+    c->first++;
+    c->count--;
+    c->answered++;
+    c->deadline = engine_now() + e->timeout;
+    response_init(&c->response);
+}
+
+/**
+ * Return transfer to those not yet queued.
+ * @param   e           Pointer to Engine structure
+ * @param   index       Index of transfer
+ **/
+static void engine_requeue(Engine *e, size_t index) {
+    e->transfers[index].assigned = false;
+    e->unassigned++;
+    if(index < e->pending) e->pending = index;
+}
+
+/**
+ * Fail every transfer queued on connection and close it.
+ * @param   e           Pointer to Engine structure
+ * @param   c           Pointer to Connection structure
+ * @param   error       Reason transfers failed
+ **/
+static void engine_abort(Engine *e, Connection *c, const char *error) {
+    for(size_t i = 0; i < c->count; i++){
+        engine_finish(e, &e->transfers[c->queue[c->first + i]], error);
+    }
+    connection_close(c);
+}
+
+/**
+ * Close connection that was lost. The transfer whose response had begun
+ * fails, as does the first one on a connection that answered nothing (or
+ * if force is set); the others are queued again.
+ * @param   e           Pointer to Engine structure
+ * @param   c           Pointer to Connection structure
+ * @param   error       Reason the first transfer fails
+ * @param   force       Whether the first transfer fails regardless
+ **/
+static void engine_drop(Engine *e, Connection *c, const char *error, bool force) {
+    bool started = c->response.state != RESPONSE_STATUS || c->start < c->end;
+
+    for(size_t i = 0; i < c->count; i++){
+        size_t index = c->queue[c->first + i];
+        if(i == 0 && (force || started || !c->answered)){
+            e->transfers[index].status = c->response.status;
+            engine_finish(e, &e->transfers[index], error);
+        }
+        else{
+            engine_requeue(e, index);
+        }
+    }
+    connection_close(c);
+}
+
+/**
+ * Find first transfer not yet queued.
+ * @param   e           Pointer to Engine structure
+ * @param   host        Pointer to Host structure to match (NULL for any)
+ * @return  Index of transfer (ntransfers if there is none).
+ **/
+static size_t engine_find(Engine *e, const Host *host) {
+    while(e->pending < e->ntransfers && e->transfers[e->pending].assigned) e->pending++;
+
+    size_t i = e->pending;
+    while(i < e->ntransfers && (e->transfers[i].assigned || (host && e->transfers[i].host != host))) i++;
+    return i;
+}
+
+/**
+ * Give idle connection its next batch of requests: those to the server it
+ * is connected to if there are any, otherwise those to the host of the
+ * first transfer not yet queued (on a new connection). Batches split what
+ * is left among the connections, up to the pipeline depth.
+ * @param   e           Pointer to Engine structure
+ * @param   c           Pointer to Connection structure
+ **/
+static void engine_assign(Engine *e, Connection *c) {
+    size_t k = c->host ? engine_find(e, c->host) : e->ntransfers;
+
+    if(k == e->ntransfers){
+        connection_close(c);
+        if(!e->unassigned) return;
+        k = engine_find(e, NULL);
+    }
+
+    Host  *host  = e->transfers[k].host;
+    size_t batch = (e->unassigned + e->nconnections - 1) / e->nconnections;
+    if(batch > PIPELINE_DEPTH) batch = PIPELINE_DEPTH;
+
+    double now = engine_now();
+    c->first    = c->count = 0;
+    c->deadline = now + e->timeout;
+    for(size_t i = k; i < e->ntransfers && c->count < batch; i++){
+        Transfer *t = &e->transfers[i];
+        if(t->assigned || t->host != host) continue;
+
+        t->assigned = true;
+        t->start    = now;
+        c->queue[c->count++] = i;
+        e->unassigned--;
+    }
+
+    if(!c->host){
+        if(!host->resolved){
+            host->addresses = socket_resolve(host->url->host, host->url->port);
+            host->resolved  = true;
+        }
+        if(!host->addresses || !connection_open(c, e->epoll, host, host->addresses)){
+            engine_abort(e, c, "connect failed");
+            return;
+        }
+    }
+
+    for(size_t i = 0; i < c->count; i++){
+        connection_request(c, &e->transfers[c->queue[i]]);
+    }
+    if(!c->connecting && !connection_flush(c)){
+        engine_drop(e, c, "send failed", false);
+        return;
+    }
+    connection_watch(c, e->epoll);
+}
+
+/**
+ * Whether the response headers of ranged transfer name the range asked for
+ * (a server that sends the whole body instead must not be written at the
+ * offset of the range).
+ * @param   t           Pointer to Transfer structure
+ * @param   r           Pointer to Response structure
+ * @return  true if the response is the range.
+ **/
+static bool engine_range(const Transfer *t, const Response *r) {
+    return r->status == 206 && r->has_range && r->range_first == t->first && r->range_last == t->last
+        && (t->size == UINT64_MAX || r->range_total == t->size);
+}
+
+/**
+ * Parse responses from the bytes received on connection, finishing the
+ * transfers at the front of its queue as their responses end.
+ * @param   e           Pointer to Engine structure
+ * @param   c           Pointer to Connection structure
+ **/
+static void engine_parse(Engine *e, Connection *c) {
+    while(c->count && (c->start < c->end || c->response.state == RESPONSE_DONE)){
+        Transfer     *t     = &e->transfers[c->queue[c->first]];
+        ResponseState state = c->response.state;
+        const char   *body;
+        size_t        nbody;
+
+        if(state == RESPONSE_STATUS) c->response.head = t->head;
+        size_t used = response_parse(&c->response, c->buffer + c->start, c->end - c->start, &body, &nbody);
+
+        c->start += used;
+        if(nbody){
+            engine_body(e, t, body, nbody);
+        }
+
+        if(c->response.state == RESPONSE_ERROR || (!used && c->end - c->start == CONNECTION_BUFFER)){
+            engine_drop(e, c, c->response.error ? c->response.error : "line too long", true);
+            return;
+        }
+
+        // Headers ended (not those of an interim response)
+        if(t->ranged && state == RESPONSE_HEADERS && c->response.state > RESPONSE_HEADERS && !engine_range(t, &c->response)){
+            engine_drop(e, c, "range not honored", true);
+            return;
+        }
+
+        if(c->response.state == RESPONSE_DONE){
+            bool closing = c->response.closing;
+
+            engine_complete(e, c);
+            if(closing){
+                engine_drop(e, c, "connection closed", false);
+                return;
+            }
+        }
+        else if(!used){
+            break;
+        }
+    }
+}
+
+/**
+ * Handle epoll events of connection.
+ * @param   e           Pointer to Engine structure
+ * @param   c           Pointer to Connection structure
+ * @param   events      epoll events
+ **/
+static void engine_event(Engine *e, Connection *c, uint32_t events) {
+    if(c->connecting){
+        if(!connection_connected(c)){
+            // Try the next address
+            if(!c->address->ai_next || !connection_open(c, e->epoll, c->host, c->address->ai_next)){
+                engine_abort(e, c, "connect failed");
+            }
+            return;
+        }
+        events |= EPOLLOUT;
+    }
+
+    if((events & EPOLLOUT) && !connection_flush(c)){
+        engine_drop(e, c, "send failed", false);
+        return;
+    }
+
+    if(events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+        bool     open   = true;
+        size_t   unread = c->end - c->start;
+        uint64_t total  = e->total;
+        if(!engine_splice(e, c, &open)){
+            open = connection_receive(c);
+        }
+
+        // Bytes arriving restart the timeout: it limits silence, not how
+        // long a response may take
+        if(c->end - c->start != unread || e->total != total){
+            c->deadline = engine_now() + e->timeout;
+        }
+        engine_parse(e, c);
+
+        if(!open && c->fd >= 0){
+            if(c->count && response_finish(&c->response)){
+                engine_complete(e, c);
+            }
+            engine_drop(e, c, c->response.error ? c->response.error : "connection closed", false);
+            return;
+        }
+    }
+
+    if(c->fd >= 0){
+        connection_watch(c, e->epoll);
+    }
+}
+
+/* Engine Functions */
+
+/**
+ * Initialize engine with a transfer for each URL.
+ * @param   e           Pointer to Engine structure
+ * @param   urls        Array of URL structures
+ * @param   nurls       Number of URLs
+ * @param   parallel    Maximum number of connections at once (-P)
+ * @param   timeout     Seconds a response may go without bytes (-m)
+ * @param   output      File descriptor to write bodies to
+ * @return  true if the engine is ready.
+ **/
+bool    engine_init(Engine *e, const URL *urls, size_t nurls, size_t parallel, double timeout, int output) {
+    *e = (Engine){
+        .epoll        = epoll_create1(EPOLL_CLOEXEC),
+        .output       = output,
+        .pipe         = {-1, -1},
+        .transfers    = calloc(nurls, sizeof(Transfer)),
+        .ntransfers   = nurls,
+        .connections  = calloc(parallel, sizeof(Connection)),
+        .nconnections = parallel,
+        .hosts        = calloc(nurls, sizeof(Host)),
+        .unassigned   = nurls,
+        .timeout      = timeout,
+    };
+
+    for(size_t i = 0; i < nurls; i++){
+        e->transfers[i].spool = -1;
+        e->transfers[i].size  = UINT64_MAX;
+    }
+    for(size_t i = 0; i < parallel; i++){
+        connection_init(&e->connections[i]);
+    }
+
+    if(e->epoll < 0){
+        perror("epoll_create1");
+        return false;
+    }
+
+    // Bodies are spliced through a pipe as large as allowed
+    if(pipe2(e->pipe, O_CLOEXEC) == 0){
+        fcntl(e->pipe[1], F_SETPIPE_SZ, SPLICE_PIPE);
+        int size = fcntl(e->pipe[1], F_GETPIPE_SZ);
+        e->npipe  = size > 0 ? size : 1<<16;
+        e->splice = true;
+    }
+
+    // Thousands of connections and spools need as many descriptors
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max){
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    for(size_t i = 0; i < nurls; i++){
+        Host *host = e->hosts;
+        while(host < e->hosts + e->nhosts && !(streq(host->url->host, urls[i].host) && streq(host->url->port, urls[i].port))) host++;
+        if(host == e->hosts + e->nhosts){
+            host->url = &urls[i];
+            e->nhosts++;
+        }
+
+        e->transfers[i].url  = &urls[i];
+        e->transfers[i].host = host;
+    }
+
+    return true;
+}
+
+/**
+ * Run transfers until all are finished: idle connections are given batches
+ * of pipelined requests, and responses are read as they arrive on any
+ * connection. Bodies are printed in the order of the URLs. If engine_stop
+ * is called, transfers not yet finished fail as interrupted.
+ * @param   e           Pointer to Engine structure
+ * @return  true if every response was successful and complete.
+ **/
+bool    engine_run(Engine *e) {
+    struct epoll_event events[ENGINE_EVENTS];
+
+    while(e->finished < e->ntransfers && !EngineStop){
+        for(size_t i = 0; i < e->nconnections; i++){
+            if(!e->connections[i].count) engine_assign(e, &e->connections[i]);
+        }
+
+        // Wait no longer than the earliest deadline
+        double now  = engine_now();
+        double next = INFINITY;
+        bool   late = false;
+        for(size_t i = 0; i < e->nconnections; i++){
+            Connection *c = &e->connections[i];
+            if(!c->count) continue;
+            if(c->deadline <= now){
+                engine_drop(e, c, "timeout", true);
+                late = true;
+            }
+            else if(c->deadline < next){
+                next = c->deadline;
+            }
+        }
+        if(late || e->finished == e->ntransfers) continue;
+
+        int wait = isinf(next) ? -1 : (int)((next - now) * 1000) + 1;
+        int n    = epoll_wait(e->epoll, events, ENGINE_EVENTS, wait);
+        for(int i = 0; i < n; i++){
+            Connection *c = events[i].data.ptr;
+            if(c->fd >= 0) engine_event(e, c, events[i].events);
+        }
+    }
+
+    for(size_t i = 0; i < e->nconnections && EngineStop; i++){
+        Connection *c = &e->connections[i];
+        if(c->count) e->transfers[c->queue[c->first]].status = c->response.status;
+    }
+    for(size_t i = 0; i < e->ntransfers && EngineStop; i++){
+        Transfer *t = &e->transfers[i];
+        if(t->done) continue;
+        if(!t->assigned) t->start = engine_now();
+        engine_finish(e, t, "interrupted");
+    }
+
+    bool success = true;
+    for(size_t i = 0; i < e->ntransfers; i++){
+        const Transfer *t = &e->transfers[i];
+        if(t->error || t->status != (t->ranged ? 206 : 200)) success = false;
+    }
+    return success;
+}
+
+/**
+ * Print summary of each transfer to standard error: status, body bytes,
+ * time and URL (and range), with the reason for any failure.
+ * @param   e           Pointer to Engine structure
+ **/
+void    engine_report(const Engine *e) {
+    for(size_t i = 0; i < e->ntransfers; i++){
+        const Transfer *t = &e->transfers[i];
+        char range[64] = "";
+        if(t->ranged){
+            snprintf(range, sizeof(range), " [%" PRIu64 "-%" PRIu64 "]", t->first, t->last);
+        }
+        fprintf(stderr, "%3d %10" PRIu64 " %8.3f s  %s:%s/%s%s%s%s\n",
+            t->status, t->bytes, t->elapsed, t->url->host, t->url->port, t->url->path, range,
+            t->error ? "  " : "", t->error ? t->error : "");
+    }
+}
+
+/**
+ * Close connections and deallocate engine.
+ * @param   e           Pointer to Engine structure
+ **/
+void    engine_delete(Engine *e) {
+    for(size_t i = 0; i < e->nconnections; i++){
+        connection_delete(&e->connections[i]);
+    }
+    for(size_t i = 0; i < e->nhosts; i++){
+        if(e->hosts[i].addresses) freeaddrinfo(e->hosts[i].addresses);
+    }
+    for(size_t i = 0; i < e->ntransfers; i++){
+        if(e->transfers[i].spool >= 0) close(e->transfers[i].spool);
+    }
+    if(e->epoll >= 0) close(e->epoll);
+    if(e->pipe[0] >= 0) close(e->pipe[0]);
+    if(e->pipe[1] >= 0) close(e->pipe[1]);
+    free(e->connections);
+    free(e->hosts);
+    free(e->transfers);
+}
+
+/**
+ * Ask running engine to stop (safe to call from a signal handler).
+ * @param   signum      Signal number
+ **/
+void    engine_stop(int signum) {
+    (void)signum;
+    EngineStop = 1;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
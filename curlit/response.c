@@ -0,0 +1,382 @@
+/* response.c: Incremental HTTP response parser */
+
+#include "curlit.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* Internal Functions */
+
+/**
+ * Trim optional whitespace (spaces and tabs) from both ends of span.
+ * @param   s           Pointer to start of span (updated)
+ * @param   n           Pointer to length of span (updated)
+ **/
+static void response_trim(const char **s, size_t *n) {
+    while(*n && (**s == ' ' || **s == '\t')){
+        (*s)++;
+        (*n)--;
+    }
+    while(*n && ((*s)[*n - 1] == ' ' || (*s)[*n - 1] == '\t')) (*n)--;
+}
+
+/**
+ * Whether comma-separated list in span contains token, ignoring case.
+ * @param   s           Start of list
+ * @param   n           Length of list
+ * @param   token       Token to find
+ * @param   last        Whether token must be the last element
+ * @return  true if the list contains token.
+ **/
+static bool response_list(const char *s, size_t n, const char *token, bool last) {
+    size_t length = strlen(token);
+    bool   found  = false;
+
+    while(n){
+        const char *comma = memchr(s, ',', n);
+        const char *item  = s;
+        size_t      nitem = comma ? (size_t)(comma - s) : n;
+
+        s += nitem + (comma != NULL);
+        n -= nitem + (comma != NULL);
+        response_trim(&item, &nitem);
+        if(!nitem) continue;
+
+        found = nitem == length && strncasecmp(item, token, length) == 0;
+        if(found && !last) return true;
+    }
+    return found;
+}
+
+/**
+ * Parse unsigned number filling span.
+ * @param   s           Start of number
+ * @param   n           Length of number
+ * @param   base        Base (10 or 16)
+ * @param   value       Pointer to value
+ * @return  false if span is empty, has other characters, or overflows 64
+ * bits.
+ **/
+static bool response_number(const char *s, size_t n, unsigned base, uint64_t *value) {
+    *value = 0;
+    if(!n) return false;
+
+    for(size_t i = 0; i < n; i++){
+        unsigned digit;
+        if(isdigit((unsigned char)s[i])){
+            digit = s[i] - '0';
+        }
+        else if(base == 16 && isxdigit((unsigned char)s[i])){
+            digit = tolower((unsigned char)s[i]) - 'a' + 10;
+        }
+        else{
+            return false;
+        }
+
+        if(*value > (UINT64_MAX - digit) / base) return false;
+        *value = *value * base + digit;
+    }
+    return true;
+}
+
+/**
+ * Copy header value into field, or leave it empty if it does not fit.
+ * @param   field       Field of VALIDATOR_MAX bytes
+ * @param   s           Start of value
+ * @param   n           Length of value
+ **/
+static void response_copy(char *field, const char *s, size_t n) {
+    if(n >= VALIDATOR_MAX) n = 0;
+    memcpy(field, s, n);
+    field[n] = '\0';
+}
+
+/**
+ * Mark response malformed.
+ * @param   r           Pointer to Response structure
+ * @param   error       Reason
+ **/
+static void response_error(Response *r, const char *error) {
+    r->state = RESPONSE_ERROR;
+    r->error = error;
+}
+
+/**
+ * Parse status line: HTTP/1.x, a three-digit code and an optional reason.
+ * @param   r           Pointer to Response structure
+ * @param   s           Start of line
+ * @param   n           Length of line
+ **/
+static void response_status(Response *r, const char *s, size_t n) {
+    if(n < 12 || strncmp(s, "HTTP/1.", 7) != 0 || !isdigit((unsigned char)s[7]) || s[8] != ' '
+        || !isdigit((unsigned char)s[9]) || !isdigit((unsigned char)s[10]) || !isdigit((unsigned char)s[11])
+        || (n > 12 && s[12] != ' ')){
+        response_error(r, "bad status line");
+        return;
+    }
+
+    // HTTP/1.0 closes by default
+    r->minor   = s[7] - '0';
+    r->status  = (s[9] - '0') * 100 + (s[10] - '0') * 10 + (s[11] - '0');
+    r->closing = r->minor == 0;
+    r->state   = RESPONSE_HEADERS;
+}
+
+/**
+ * Parse header line: a name, a colon and a value. Names are matched
+ * without regard to case; only the headers that frame the body or the
+ * connection, and those that identify the body for ranges, matter.
+ * @param   r           Pointer to Response structure
+ * @param   s           Start of line
+ * @param   n           Length of line
+ **/
+static void response_header(Response *r, const char *s, size_t n) {
+    const char *colon = memchr(s, ':', n);
+    if(!colon || colon == s || colon[-1] == ' ' || colon[-1] == '\t' || *s == ' ' || *s == '\t'){
+        response_error(r, "bad header");
+        return;
+    }
+
+    size_t      nname  = colon - s;
+    const char *value  = colon + 1;
+    size_t      nvalue = n - nname - 1;
+    response_trim(&value, &nvalue);
+
+    if(nname == 14 && strncasecmp(s, "Content-Length", nname) == 0){
+        // Repeats must agree
+        uint64_t length;
+        if(!response_number(value, nvalue, 10, &length) || (r->has_length && length != r->length)){
+            response_error(r, "bad Content-Length");
+            return;
+        }
+        r->length     = length;
+        r->has_length = true;
+    }
+    else if(nname == 17 && strncasecmp(s, "Transfer-Encoding", nname) == 0){
+        r->encoded = true;
+        r->chunked = response_list(value, nvalue, "chunked", true);
+    }
+    else if(nname == 13 && strncasecmp(s, "Content-Range", nname) == 0){
+        // bytes FIRST-LAST/TOTAL
+        const char *dash  = memchr(value, '-', nvalue);
+        const char *slash = memchr(value, '/', nvalue);
+        if(nvalue < 6 || strncasecmp(value, "bytes ", 6) != 0 || !dash || !slash || slash < dash
+            || !response_number(value + 6, dash - value - 6, 10, &r->range_first)
+            || !response_number(dash + 1, slash - dash - 1, 10, &r->range_last)
+            || !response_number(slash + 1, value + nvalue - slash - 1, 10, &r->range_total)
+            || r->range_first > r->range_last || r->range_last >= r->range_total){
+            response_error(r, "bad Content-Range");
+            return;
+        }
+        r->has_range = true;
+    }
+    else if(nname == 13 && strncasecmp(s, "Accept-Ranges", nname) == 0){
+        r->ranges = response_list(value, nvalue, "bytes", false);
+    }
+    else if(nname == 4 && strncasecmp(s, "ETag", nname) == 0){
+        response_copy(r->etag, value, nvalue);
+    }
+    else if(nname == 13 && strncasecmp(s, "Last-Modified", nname) == 0){
+        response_copy(r->modified, value, nvalue);
+    }
+    else if(nname == 10 && strncasecmp(s, "Connection", nname) == 0){
+        if(response_list(value, nvalue, "close", false)){
+            r->closing = true;
+        }
+        else if(response_list(value, nvalue, "keep-alive", false)){
+            r->closing = false;
+        }
+    }
+}
+
+/**
+ * Choose how the body is read once the headers have ended.
+ * @param   r           Pointer to Response structure
+ **/
+static void response_body(Response *r) {
+    if(r->status / 100 == 1){
+        // Interim response: the real one follows
+        bool head = r->head;
+        response_init(r);
+        r->head = head;
+    }
+    else if(r->status == 204 || r->status == 304 || r->head){
+        r->state = RESPONSE_DONE;
+    }
+    else if(r->encoded){
+        // Transfer-Encoding overrides Content-Length (and such a connection
+        // is not trusted again); a final coding other than chunked lasts
+        // until close
+        r->closing    = r->closing || r->has_length || !r->chunked;
+        r->has_length = false;
+        r->state      = r->chunked ? RESPONSE_CHUNK_SIZE : RESPONSE_UNTIL_CLOSE;
+    }
+    else if(r->has_length){
+        r->state = r->length ? RESPONSE_BODY : RESPONSE_DONE;
+    }
+    else{
+        r->state   = RESPONSE_UNTIL_CLOSE;
+        r->closing = true;
+    }
+}
+
+/**
+ * Parse size line of chunk: hexadecimal size and optional extensions.
+ * @param   r           Pointer to Response structure
+ * @param   s           Start of line
+ * @param   n           Length of line
+ **/
+static void response_chunk(Response *r, const char *s, size_t n) {
+    const char *extension = memchr(s, ';', n);
+    if(extension) n = extension - s;
+    response_trim(&s, &n);
+
+    if(!response_number(s, n, 16, &r->length)){
+        response_error(r, "bad chunk size");
+        return;
+    }
+    r->state = r->length ? RESPONSE_CHUNK_DATA : RESPONSE_TRAILERS;
+}
+
+/* Response Functions */
+
+/**
+ * Initialize parser for the next response (set head if the request was
+ * HEAD).
+ * @param   r           Pointer to Response structure
+ **/
+void    response_init(Response *r) {
+    *r = (Response){.state = RESPONSE_STATUS};
+}
+
+/**
+ * Parse one step of the response in place: a whole status, header or chunk
+ * line, or as much of the body as is there. Nothing is copied; body bytes
+ * are returned as a span of data.
+ * @param   r           Pointer to Response structure
+ * @param   data        Bytes received
+ * @param   n           Number of bytes
+ * @param   body        Pointer to start of body bytes in data
+ * @param   nbody       Pointer to number of body bytes (0 if none)
+ * @return  Number of bytes of data consumed (0 if more are needed).
+ **/
+size_t  response_parse(Response *r, const char *data, size_t n, const char **body, size_t *nbody) {
+    uint64_t pending = response_pending(r);
+
+    *nbody = 0;
+
+    if(pending){
+        size_t used = n < pending ? n : pending;
+        *body  = data;
+        *nbody = used;
+        response_advance(r, used);
+        return used;
+    }
+    if(r->state == RESPONSE_DONE || r->state == RESPONSE_ERROR){
+        return 0;
+    }
+
+    // Lines end with CRLF (a bare LF is tolerated)
+    const char *newline = memchr(data, '\n', n);
+    if(!newline){
+        return 0;
+    }
+    size_t length = newline - data - (newline > data && newline[-1] == '\r');
+
+    switch(r->state){
+        case RESPONSE_STATUS:
+            response_status(r, data, length);
+            break;
+
+        case RESPONSE_HEADERS:
+            if(length){
+                response_header(r, data, length);
+            }
+            else{
+                response_body(r);
+            }
+            break;
+
+        case RESPONSE_CHUNK_SIZE:
+            response_chunk(r, data, length);
+            break;
+
+        case RESPONSE_CHUNK_END:
+            if(length){
+                response_error(r, "bad chunk end");
+                break;
+            }
+            r->state = RESPONSE_CHUNK_SIZE;
+            break;
+
+        case RESPONSE_TRAILERS:
+            if(!length) r->state = RESPONSE_DONE;
+            break;
+
+        default:
+            break;
+    }
+
+    return newline - data + 1;
+}
+
+/**
+ * Number of body bytes that come next in the stream, which may be taken
+ * without parsing (with response_advance).
+ * @param   r           Pointer to Response structure
+ * @return  Number of bytes (0 if a line comes next, UINT64_MAX if the body
+ * lasts until end of stream).
+ **/
+uint64_t response_pending(const Response *r) {
+    switch(r->state){
+        case RESPONSE_BODY:
+        case RESPONSE_CHUNK_DATA:
+            return r->length;
+        case RESPONSE_UNTIL_CLOSE:
+            return UINT64_MAX;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Account for body bytes taken from the stream.
+ * @param   r           Pointer to Response structure
+ * @param   n           Number of bytes (at most response_pending)
+ **/
+void    response_advance(Response *r, size_t n) {
+    if(r->state == RESPONSE_UNTIL_CLOSE || !n) return;
+
+    if(!(r->length -= n)){
+        r->state = r->state == RESPONSE_BODY ? RESPONSE_DONE : RESPONSE_CHUNK_END;
+    }
+}
+
+/**
+ * Finish response at end of stream: only a body without a length may end
+ * there; anything else begun is short.
+ * @param   r           Pointer to Response structure
+ * @return  true if the response is complete.
+ **/
+bool    response_finish(Response *r) {
+    switch(r->state){
+        case RESPONSE_UNTIL_CLOSE:
+            r->state = RESPONSE_DONE;
+            return true;
+        case RESPONSE_DONE:
+            return true;
+        case RESPONSE_STATUS:
+        case RESPONSE_ERROR:
+            return false;
+        case RESPONSE_BODY:
+            response_error(r, "body shorter than Content-Length");
+            return false;
+        default:
+            response_error(r, "truncated response");
+            return false;
+    }
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
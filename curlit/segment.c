@@ -0,0 +1,281 @@
+/* segment.c: Parallel ranged download of one URL into a file */
+
+#include "curlit.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Segment Structure */
+
+typedef struct {
+    uint64_t    first;      // First byte of segment
+    uint64_t    last;       // Last byte of segment
+    uint64_t    done;       // Bytes of segment already in the file
+} Segment;
+
+/* Constants */
+
+#define SEGMENT_SUFFIX  ".segments"     // Suffix of the progress file
+#define SEGMENT_MAGIC   "curlit-segments 2"
+
+/* Internal Functions */
+
+/**
+ * Find the size of the body of URL, whether its server serves byte ranges
+ * and what identifies the body (ETag or Last-Modified), with a HEAD request.
+ * @param   url         Pointer to URL structure
+ * @param   timeout     Seconds a response may go without bytes
+ * @param   size        Pointer to size (UINT64_MAX if unknown)
+ * @param   ranges      Pointer to whether byte ranges are accepted
+ * @param   validator   Buffer of VALIDATOR_MAX bytes for the validator
+ * ("" if none)
+ * @return  true if the server answered 200.
+ **/
+static bool segment_probe(const URL *url, double timeout, uint64_t *size, bool *ranges, char *validator) {
+    Engine engine;
+    bool   success = false;
+
+    if(engine_init(&engine, url, 1, 1, timeout, -1)){
+        engine.transfers[0].head = true;
+        success = engine_run(&engine);
+        *size   = engine.transfers[0].size;
+        *ranges = engine.transfers[0].ranges;
+        strcpy(validator, engine.transfers[0].validator);
+        if(!success) engine_report(&engine);
+    }
+    engine_delete(&engine);
+    return success;
+}
+
+/**
+ * Load progress of an earlier download of the same URL, size and
+ * validator (a body that cannot be identified is never resumed, since a
+ * replacement of the same size would be mixed into the old one).
+ * @param   progress    Path of progress file
+ * @param   url         Pointer to URL structure
+ * @param   size        Size of body
+ * @param   validator   ETag or Last-Modified of body ("" if none)
+ * @param   nsegments   Pointer to number of segments (updated)
+ * @return  Array of segments (NULL if there is no matching progress).
+ **/
+static Segment *segment_load(const char *progress, const URL *url, uint64_t size, const char *validator, size_t *nsegments) {
+    FILE *stream = *validator ? fopen(progress, "r") : NULL;
+    if(!stream){
+        return NULL;
+    }
+
+    char     line[BUFSIZ];
+    char     target[BUFSIZ];
+    char     tag[VALIDATOR_MAX + 1];
+    uint64_t length;
+    size_t   count;
+    Segment *segments = NULL;
+
+    snprintf(target, sizeof(target), "%s:%s/%s\n", url->host, url->port, url->path);
+    snprintf(tag, sizeof(tag), "%s\n", validator);
+    if(!fgets(line, sizeof(line), stream) || !streq(line, SEGMENT_MAGIC "\n")
+        || !fgets(line, sizeof(line), stream) || !streq(line, target)
+        || !fgets(line, sizeof(line), stream) || !streq(line, tag)
+        || fscanf(stream, "%" SCNu64 " %zu", &length, &count) != 2 || length != size || !count){
+        goto fail;
+    }
+
+    segments = calloc(count, sizeof(Segment));
+    for(size_t i = 0; i < count; i++){
+        Segment *s = &segments[i];
+        if(fscanf(stream, "%" SCNu64 " %" SCNu64 " %" SCNu64, &s->first, &s->last, &s->done) != 3
+            || s->first > s->last || s->last >= size || s->done > s->last - s->first + 1){
+            goto fail;
+        }
+    }
+
+    fclose(stream);
+    *nsegments = count;
+    return segments;
+
+fail:
+    fclose(stream);
+    free(segments);
+    return NULL;
+}
+
+/**
+ * Save progress so an interrupted download can be resumed.
+ * @param   progress    Path of progress file
+ * @param   url         Pointer to URL structure
+ * @param   size        Size of body
+ * @param   validator   ETag or Last-Modified of body ("" if none)
+ * @param   segments    Array of segments
+ * @param   nsegments   Number of segments
+ **/
+static void segment_save(const char *progress, const URL *url, uint64_t size, const char *validator, const Segment *segments, size_t nsegments) {
+    FILE *stream = fopen(progress, "w");
+    if(!stream){
+        fprintf(stderr, "Unable to save %s: %s\n", progress, strerror(errno));
+        return;
+    }
+
+    fprintf(stream, SEGMENT_MAGIC "\n%s:%s/%s\n%s\n%" PRIu64 " %zu\n", url->host, url->port, url->path, validator, size, nsegments);
+    for(size_t i = 0; i < nsegments; i++){
+        fprintf(stream, "%" PRIu64 " %" PRIu64 " %" PRIu64 "\n", segments[i].first, segments[i].last, segments[i].done);
+    }
+    if(fclose(stream) != 0){
+        fprintf(stderr, "Unable to save %s: %s\n", progress, strerror(errno));
+    }
+}
+
+/**
+ * Fetch URL into file with a single request (for servers that cannot
+ * serve ranges).
+ * @param   url         Pointer to URL structure
+ * @param   path        Path of file
+ * @param   timeout     Seconds to wait for the response
+ * @param   total       Pointer to number of body bytes received
+ * @return  true if the response was successful and complete.
+ **/
+static bool segment_whole(const URL *url, const char *path, double timeout, uint64_t *total) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0){
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    Engine engine;
+    bool   success = engine_init(&engine, url, 1, 1, timeout, fd) && engine_run(&engine);
+    *total = engine.total;
+    engine_report(&engine);
+    engine_delete(&engine);
+
+    if(close(fd) < 0){
+        fprintf(stderr, "Unable to close %s: %s\n", path, strerror(errno));
+        success = false;
+    }
+    return success;
+}
+
+/* Segment Functions */
+
+/**
+ * Fetch URL into file at path as nsegments byte ranges over as many
+ * connections at once, each written straight to its offset in the file.
+ *
+ * The size is found with HEAD first; servers that do not serve ranges (or
+ * give no size) are fetched whole instead. Progress of an unfinished
+ * download is kept in path.segments, and a later call for the same URL,
+ * size and ETag (or Last-Modified) resumes each segment where it stopped;
+ * otherwise the file starts over. Ranges carry If-Range, so a body replaced
+ * mid-download fails instead of being mixed in. SIGINT and SIGTERM stop the
+ * download with its progress saved.
+ * @param   url         Pointer to URL structure
+ * @param   path        Path of file
+ * @param   nsegments   Number of segments (if not resuming)
+ * @param   timeout     Seconds a response may go without bytes
+ * @param   total       Pointer to number of body bytes received
+ * @return  true if every segment was received in full.
+ **/
+bool    segment_fetch(const URL *url, const char *path, size_t nsegments, double timeout, uint64_t *total) {
+    uint64_t size;
+    bool     ranges;
+    char     validator[VALIDATOR_MAX];
+
+    *total = 0;
+    if(!segment_probe(url, timeout, &size, &ranges, validator)){
+        return false;
+    }
+    if(size == UINT64_MAX || !size || !ranges){
+        fprintf(stderr, "Server gives no size or byte ranges; fetching whole\n");
+        return segment_whole(url, path, timeout, total);
+    }
+    if(nsegments > size) nsegments = size;
+
+    // Resume matching progress, otherwise split the body evenly
+    char progress[PATH_MAX];
+    if(snprintf(progress, sizeof(progress), "%s" SEGMENT_SUFFIX, path) >= (int)sizeof(progress)){
+        fprintf(stderr, "Path too long: %s\n", path);
+        return false;
+    }
+
+    Segment *segments = segment_load(progress, url, size, validator, &nsegments);
+    bool     resumed  = segments != NULL;
+    if(!resumed){
+        segments = calloc(nsegments, sizeof(Segment));
+        for(size_t i = 0; i < nsegments; i++){
+            segments[i].first = size / nsegments * i;
+            segments[i].last  = i + 1 < nsegments ? size / nsegments * (i + 1) - 1 : size - 1;
+        }
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | (resumed ? 0 : O_TRUNC) | O_CLOEXEC, 0644);
+    if(fd < 0 || ftruncate(fd, size) < 0){
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        if(fd >= 0) close(fd);
+        free(segments);
+        return false;
+    }
+
+    // One transfer (and connection) per unfinished segment
+    URL    *urls      = calloc(nsegments, sizeof(URL));
+    size_t *indices   = calloc(nsegments, sizeof(size_t));
+    size_t  ntransfer = 0;
+    for(size_t i = 0; i < nsegments; i++){
+        if(segments[i].first + segments[i].done > segments[i].last) continue;
+        urls[ntransfer]      = *url;
+        indices[ntransfer++] = i;
+    }
+    if(resumed){
+        fprintf(stderr, "Resuming %zu of %zu segments\n", ntransfer, nsegments);
+    }
+
+    bool success = true;
+    if(ntransfer){
+        Engine engine;
+        success = engine_init(&engine, urls, ntransfer, ntransfer, timeout, fd);
+        for(size_t i = 0; success && i < ntransfer; i++){
+            Transfer *t = &engine.transfers[i];
+            Segment  *s = &segments[indices[i]];
+            t->ranged = true;
+            t->first  = s->first + s->done;
+            t->last   = s->last;
+            t->size   = size;
+            strcpy(t->validator, validator);
+        }
+
+        void (*interrupt)(int) = signal(SIGINT, engine_stop);
+        void (*terminate)(int) = signal(SIGTERM, engine_stop);
+        success = success && engine_run(&engine);
+        signal(SIGINT, interrupt);
+        signal(SIGTERM, terminate);
+
+        engine_report(&engine);
+        for(size_t i = 0; i < ntransfer; i++){
+            segments[indices[i]].done += engine.transfers[i].bytes;
+        }
+        *total = engine.total;
+        engine_delete(&engine);
+    }
+
+    if(close(fd) < 0){
+        fprintf(stderr, "Unable to close %s: %s\n", path, strerror(errno));
+        success = false;
+    }
+
+    if(success){
+        unlink(progress);
+    }
+    else{
+        segment_save(progress, url, size, validator, segments, nsegments);
+    }
+
+    free(indices);
+    free(urls);
+    free(segments);
+    return success;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -4,8 +4,11 @@
 
 #include <stdio.h>
 
+#include <netdb.h>
+
 /* Functions */
 
-FILE *	socket_dial(const char *host, const char *port);
+struct addrinfo *socket_resolve(const char *host, const char *port);
+int	socket_connect(const struct addrinfo *address);
 
 /* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
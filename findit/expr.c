@@ -0,0 +1,529 @@
+/* expr.c: Filter expression parser and compiler */
+
+#include "findit.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Macros */
+
+#define streq(a, b) (strcmp(a, b) == 0)
+
+/* Test Table */
+
+typedef struct {
+    const char *token;      // Command line token
+    Filter      filter;     // Predicate function
+    int         cost;       // Relative cost of evaluating predicate
+    bool        argument;   // Whether token takes an argument
+    int         mode;       // Access mode (for filter_by_mode)
+    int         flags;      // Matcher flags (for filter_by_name and filter_by_path)
+    StatNeed    stat;       // When predicate needs the entry's lstat
+} Test;
+
+// Costs order predicates by the work they do per entry: d_type comparisons
+// are nearly free, name matching touches only the name, regular expressions
+// scan the whole path, metadata tests share one (possibly batched) lstat,
+// and access checks always cost a system call.
+static const Test Tests[] = {
+    {"-type",        filter_by_type,   1,   true,   0,     0,                             STAT_UNTYPED},
+    {"-name",        filter_by_name,   2,   true,   0,     0,                             STAT_NEVER},
+    {"-iname",       filter_by_name,   2,   true,   0,     MATCHER_FOLD,                  STAT_NEVER},
+    {"-regex",       filter_by_path,   8,   true,   0,     MATCHER_REGEX,                 STAT_NEVER},
+    {"-iregex",      filter_by_path,   8,   true,   0,     MATCHER_REGEX | MATCHER_FOLD,  STAT_NEVER},
+    {"-size",        filter_by_size,   12,  true,   0,     0,                             STAT_ALWAYS},
+    {"-mtime",       filter_by_mtime,  12,  true,   0,     0,                             STAT_ALWAYS},
+    {"-newer",       filter_by_newer,  12,  true,   0,     0,                             STAT_ALWAYS},
+    {"-executable",  filter_by_mode,   16,  false,  X_OK,  0,                             STAT_NEVER},
+    {"-readable",    filter_by_mode,   16,  false,  R_OK,  0,                             STAT_NEVER},
+    {"-writable",    filter_by_mode,   16,  false,  W_OK,  0,                             STAT_NEVER},
+    {"-prune",       filter_prune,     0,   false,  0,     0,                             STAT_NEVER},
+    {NULL,           NULL,             0,   false,  0,     0,                             STAT_NEVER},
+};
+
+/* Expression Structure */
+
+typedef enum {
+    EXPR_TEST,
+    EXPR_NOT,
+    EXPR_AND,
+    EXPR_OR,
+} ExprKind;
+
+typedef struct Expr Expr;
+struct Expr {
+    ExprKind    kind;       // Kind of expression
+    Filter      filter;     // Predicate function (EXPR_TEST)
+    Options     options;    // Predicate arguments (EXPR_TEST)
+    StatNeed    stat;       // When predicate needs lstat (EXPR_TEST)
+    int         cost;       // Estimated cost of evaluating expression
+    bool        effect;     // Whether expression has side effects (-prune)
+    Expr      **children;   // Operands (EXPR_NOT, EXPR_AND, EXPR_OR)
+    size_t      nchildren;  // Number of operands
+};
+
+/* Parser Structure */
+
+typedef struct {
+    char      **tokens;     // Expression tokens
+    size_t      ntokens;    // Number of tokens
+    size_t      next;       // Index of next unread token
+} Parser;
+
+/* Expression Functions */
+
+/**
+ * Deallocate expression tree.
+ * @param   e           Pointer to Expr structure
+ **/
+static void expr_delete(Expr *e) {
+    if(!e) return;
+
+    for(size_t i = 0; i < e->nchildren; i++){
+        expr_delete(e->children[i]);
+    }
+    free(e->children);
+    free(e);
+}
+
+/**
+ * Deallocate expression tree along with the matchers its tests own (used
+ * when compilation fails; otherwise the program takes over the matchers).
+ * @param   e           Pointer to Expr structure
+ **/
+static void expr_release(Expr *e) {
+    if(!e) return;
+
+    matcher_delete(e->options.matcher);
+    for(size_t i = 0; i < e->nchildren; i++){
+        expr_release(e->children[i]);
+        e->children[i] = NULL;
+    }
+    expr_delete(e);
+}
+
+/**
+ * Allocate operator expression, flattening nested operators of the same kind
+ * so that all operands of a chain can be reordered together.
+ * @param   kind        Kind of expression (EXPR_AND or EXPR_OR)
+ * @param   left        Left operand
+ * @param   right       Right operand
+ * @return  Pointer to new Expr structure.
+ **/
+static Expr *expr_join(ExprKind kind, Expr *left, Expr *right) {
+    Expr *e = left;
+
+    if(left->kind != kind){
+        e = calloc(1, sizeof(Expr));
+        e->kind = kind;
+        e->children = malloc(sizeof(Expr *));
+        e->children[e->nchildren++] = left;
+        e->cost = left->cost;
+        e->effect = left->effect;
+    }
+
+    e->children = realloc(e->children, (e->nchildren + 1) * sizeof(Expr *));
+    e->children[e->nchildren++] = right;
+    e->cost += right->cost;
+    e->effect |= right->effect;
+    return e;
+}
+
+/* Parser Functions */
+
+static Expr *parse_or(Parser *p);
+
+/**
+ * Return next token without consuming it.
+ * @param   p           Pointer to Parser structure
+ * @return  Next token or NULL at end of expression.
+ **/
+static const char *parse_peek(Parser *p) {
+    return p->next < p->ntokens ? p->tokens[p->next] : NULL;
+}
+
+/**
+ * Parse numeric test argument of the form [+-]N, followed for sizes by an
+ * optional unit: b (512-byte blocks, the default), c (bytes), w (two-byte
+ * words), k, M or G.
+ * @param   argument    Argument string
+ * @param   size        Whether a unit suffix is allowed
+ * @param   options     Pointer to Options structure to fill
+ * @return  true if argument is valid.
+ **/
+static bool parse_number(const char *argument, bool size, Options *options) {
+    options->compare = *argument == '+' ? 1 : *argument == '-' ? -1 : 0;
+    if(options->compare) argument++;
+    if(*argument < '0' || *argument > '9') return false;
+
+    char *end;
+    options->number = strtoll(argument, &end, 10);
+    options->unit   = 1;
+    if(!size) return *end == 0;
+
+    switch(*end){
+        case 0:
+        case 'b': options->unit = 512;          break;
+        case 'c': options->unit = 1;            break;
+        case 'w': options->unit = 2;            break;
+        case 'k': options->unit = 1LL << 10;    break;
+        case 'M': options->unit = 1LL << 20;    break;
+        case 'G': options->unit = 1LL << 30;    break;
+        default:  return false;
+    }
+    return *end == 0 || end[1] == 0;
+}
+
+/**
+ * Parse a test or parenthesized expression.
+ * @param   p           Pointer to Parser structure
+ * @return  Pointer to new Expr structure or NULL on error.
+ **/
+static Expr *parse_primary(Parser *p) {
+    const char *token = parse_peek(p);
+
+    if(!token){
+        fprintf(stderr, "findit: expected expression at end of arguments\n");
+        return NULL;
+    }
+    p->next++;
+
+    if(streq(token, "(")){
+        Expr *e = parse_or(p);
+        if(!e) return NULL;
+
+        if(!parse_peek(p) || !streq(parse_peek(p), ")")){
+            fprintf(stderr, "findit: missing ')'\n");
+            expr_release(e);
+            return NULL;
+        }
+        p->next++;
+        return e;
+    }
+
+    for(const Test *t = Tests; t->token; t++){
+        if(!streq(token, t->token)) continue;
+
+        Expr *e = calloc(1, sizeof(Expr));
+        e->kind = EXPR_TEST;
+        e->filter = t->filter;
+        e->cost = t->cost;
+        e->stat = t->stat;
+        e->effect = t->filter == filter_prune;
+        e->options.mode = t->mode;
+
+        if(!t->argument) return e;
+
+        const char *argument = parse_peek(p);
+        if(!argument){
+            fprintf(stderr, "findit: missing argument to '%s'\n", token);
+            free(e);
+            return NULL;
+        }
+        p->next++;
+
+        if(t->filter == filter_by_name || t->filter == filter_by_path){
+            if(!(e->options.matcher = matcher_create(argument, t->flags))){
+                free(e);
+                return NULL;
+            }
+        }
+        else if(t->filter == filter_by_type){
+            switch(argument[0] && !argument[1] ? argument[0] : 0){
+                case 'f': e->options.type = S_IFREG;  break;
+                case 'd': e->options.type = S_IFDIR;  break;
+                case 'l': e->options.type = S_IFLNK;  break;
+                case 'b': e->options.type = S_IFBLK;  break;
+                case 'c': e->options.type = S_IFCHR;  break;
+                case 'p': e->options.type = S_IFIFO;  break;
+                case 's': e->options.type = S_IFSOCK; break;
+                default:
+                    fprintf(stderr, "findit: unknown type '%s'\n", argument);
+                    free(e);
+                    return NULL;
+            }
+        }
+        else if(t->filter == filter_by_size || t->filter == filter_by_mtime){
+            if(!parse_number(argument, t->filter == filter_by_size, &e->options)){
+                fprintf(stderr, "findit: invalid argument '%s' to '%s'\n", argument, token);
+                free(e);
+                return NULL;
+            }
+            clock_gettime(CLOCK_REALTIME, &e->options.time);
+        }
+        else if(t->filter == filter_by_newer){
+            struct stat st;
+            if(stat(argument, &st) < 0){
+                perror(argument);
+                free(e);
+                return NULL;
+            }
+            e->options.time = st.st_mtim;
+        }
+        return e;
+    }
+
+    fprintf(stderr, "findit: unknown predicate '%s'\n", token);
+    return NULL;
+}
+
+/**
+ * Parse a possibly negated primary expression.
+ * @param   p           Pointer to Parser structure
+ * @return  Pointer to new Expr structure or NULL on error.
+ **/
+static Expr *parse_not(Parser *p) {
+    const char *token = parse_peek(p);
+
+    if(token && (streq(token, "!") || streq(token, "-not"))){
+        p->next++;
+
+        Expr *child = parse_not(p);
+        if(!child) return NULL;
+
+        Expr *e = calloc(1, sizeof(Expr));
+        e->kind = EXPR_NOT;
+        e->children = malloc(sizeof(Expr *));
+        e->children[e->nchildren++] = child;
+        e->cost = child->cost;
+        e->effect = child->effect;
+        return e;
+    }
+
+    return parse_primary(p);
+}
+
+/**
+ * Parse a chain of expressions joined by -a (or juxtaposition).
+ * @param   p           Pointer to Parser structure
+ * @return  Pointer to new Expr structure or NULL on error.
+ **/
+static Expr *parse_and(Parser *p) {
+    Expr *e = parse_not(p);
+    const char *token;
+
+    while(e && (token = parse_peek(p)) && !streq(token, ")") && !streq(token, "-o") && !streq(token, "-or")){
+        if(streq(token, "-a") || streq(token, "-and")) p->next++;
+
+        Expr *right = parse_not(p);
+        if(!right){
+            expr_release(e);
+            return NULL;
+        }
+        e = expr_join(EXPR_AND, e, right);
+    }
+
+    return e;
+}
+
+/**
+ * Parse a chain of expressions joined by -o.
+ * @param   p           Pointer to Parser structure
+ * @return  Pointer to new Expr structure or NULL on error.
+ **/
+static Expr *parse_or(Parser *p) {
+    Expr *e = parse_and(p);
+    const char *token;
+
+    while(e && (token = parse_peek(p)) && (streq(token, "-o") || streq(token, "-or"))){
+        p->next++;
+
+        Expr *right = parse_and(p);
+        if(!right){
+            expr_release(e);
+            return NULL;
+        }
+        e = expr_join(EXPR_OR, e, right);
+    }
+
+    return e;
+}
+
+/* Compiler Functions */
+
+/**
+ * Order operands of every chain from cheapest to most expensive. Tests are
+ * free of side effects, so this only changes how soon a chain short-circuits,
+ * never its result. Operands with side effects (-prune) stay in place and
+ * nothing moves across them. Insertion sort keeps equal-cost operands in
+ * command line order.
+ * @param   e           Pointer to Expr structure
+ **/
+static void expr_reorder(Expr *e) {
+    for(size_t i = 0; i < e->nchildren; i++){
+        expr_reorder(e->children[i]);
+    }
+
+    if(e->kind != EXPR_AND && e->kind != EXPR_OR) return;
+
+    for(size_t i = 1; i < e->nchildren; i++){
+        Expr  *child = e->children[i];
+        size_t j = i;
+        for(; j > 0 && !child->effect && !e->children[j - 1]->effect &&
+              e->children[j - 1]->cost > child->cost; j--){
+            e->children[j] = e->children[j - 1];
+        }
+        e->children[j] = child;
+    }
+}
+
+/**
+ * Emit instructions for expression that continue at on_true when it holds and
+ * at on_false when it does not. Operands are emitted back to front so each
+ * one's successor is already known.
+ * @param   program     Pointer to Program structure
+ * @param   e           Pointer to Expr structure
+ * @param   on_true     Jump target if expression holds
+ * @param   on_false    Jump target if expression fails
+ * @return  Index of first instruction of expression.
+ **/
+static size_t expr_emit(Program *program, Expr *e, size_t on_true, size_t on_false) {
+    switch(e->kind){
+        case EXPR_TEST:
+            program->code[program->size] = (Instruction){
+                .filter   = e->filter,
+                .options  = e->options,
+                .stat     = e->stat,
+                .on_true  = on_true,
+                .on_false = on_false,
+            };
+            return program->size++;
+        case EXPR_NOT:
+            return expr_emit(program, e->children[0], on_false, on_true);
+        case EXPR_AND:
+            for(size_t i = e->nchildren; i > 0; i--){
+                on_true = expr_emit(program, e->children[i - 1], on_true, on_false);
+            }
+            return on_true;
+        case EXPR_OR:
+            for(size_t i = e->nchildren; i > 0; i--){
+                on_false = expr_emit(program, e->children[i - 1], on_true, on_false);
+            }
+            return on_false;
+    }
+
+    return on_false;
+}
+
+/**
+ * Count tests in expression.
+ * @param   e           Pointer to Expr structure
+ * @return  Number of EXPR_TEST nodes.
+ **/
+static size_t expr_tests(Expr *e) {
+    size_t count = e->kind == EXPR_TEST;
+
+    for(size_t i = 0; i < e->nchildren; i++){
+        count += expr_tests(e->children[i]);
+    }
+    return count;
+}
+
+/* Program Functions */
+
+/**
+ * Determine whether token belongs to a filter expression.
+ * @param   token       Command line token
+ * @return  Number of arguments the token takes, or -1 if it is not part of an
+ * expression.
+ **/
+int     program_arity(const char *token) {
+    if(streq(token, "(") || streq(token, ")") || streq(token, "!") ||
+       streq(token, "-not") || streq(token, "-a") || streq(token, "-and") ||
+       streq(token, "-o") || streq(token, "-or")){
+        return 0;
+    }
+
+    for(const Test *t = Tests; t->token; t++){
+        if(streq(token, t->token)) return t->argument;
+    }
+
+    return -1;
+}
+
+/**
+ * Parse filter expression and compile it into a flat program of predicates
+ * with explicit true/false jump targets, so evaluation short-circuits without
+ * recursion. An empty expression matches everything.
+ * @param   program     Pointer to Program structure
+ * @param   tokens      Expression tokens
+ * @param   ntokens     Number of tokens
+ * @return  true if expression is valid, otherwise false.
+ **/
+bool    program_compile(Program *program, char **tokens, size_t ntokens) {
+    *program = (Program){.start = PROGRAM_ACCEPT};
+    if(ntokens == 0) return true;
+
+    Parser parser = {tokens, ntokens, 0};
+    Expr  *e = parse_or(&parser);
+
+    if(e && parser.next < ntokens){
+        fprintf(stderr, "findit: unexpected '%s'\n", tokens[parser.next]);
+        expr_release(e);
+        return false;
+    }
+    if(!e) return false;
+
+    expr_reorder(e);
+
+    program->code  = calloc(expr_tests(e), sizeof(Instruction));
+    program->start = expr_emit(program, e, PROGRAM_ACCEPT, PROGRAM_REJECT);
+
+    expr_delete(e);
+    return true;
+}
+
+/**
+ * Evaluate program against entry.
+ * @param   program     Pointer to Program structure
+ * @param   entry       Pointer to Entry structure
+ * @return  true if entry matches expression.
+ **/
+bool    program_run(const Program *program, Entry *entry) {
+    return program_resume(program, entry, program->start, false) == PROGRAM_ACCEPT;
+}
+
+/**
+ * Evaluate program against entry starting at instruction pc. When deferring,
+ * evaluation stops at the first predicate that would need an lstat the entry
+ * does not have yet, so the caller can fetch it in a batch and resume.
+ * @param   program     Pointer to Program structure
+ * @param   entry       Pointer to Entry structure
+ * @param   pc          Index of instruction to start at (or jump target)
+ * @param   defer       Whether to stop before fetching lstat
+ * @return  PROGRAM_ACCEPT, PROGRAM_REJECT, or the index of the instruction
+ * to resume at.
+ **/
+size_t  program_resume(const Program *program, Entry *entry, size_t pc, bool defer) {
+    while(pc < program->size){
+        Instruction *i = &program->code[pc];
+
+        if(defer && !entry->statted &&
+           (i->stat == STAT_ALWAYS || (i->stat == STAT_UNTYPED && entry->type == DT_UNKNOWN))){
+            return pc;
+        }
+
+        pc = i->filter(entry, &i->options) ? i->on_true : i->on_false;
+    }
+
+    return pc;
+}
+
+/**
+ * Deallocate program instructions and the matchers they own.
+ * @param   program     Pointer to Program structure
+ **/
+void    program_delete(Program *program) {
+    for(size_t i = 0; i < program->size; i++){
+        matcher_delete(program->code[i].options.matcher);
+    }
+    free(program->code);
+    program->code = NULL;
+    program->size = 0;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -5,65 +5,191 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <fnmatch.h>
+#include <dirent.h>
 #include <libgen.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-/* Filter Functions */
+/* Entry Functions */
 
 /**
- * Determines if file at specified path has matching file type.
+ * Initialize entry for a path with no open parent directory (such as the
+ * root of a walk).
+ * @param   entry       Pointer to Entry structure
  * @param   path        Path string
+ * @param   buffer      Scratch buffer of BUFSIZ bytes to hold the base name
+ **/
+void    entry_init(Entry *entry, const char *path, char *buffer) {
+    snprintf(buffer, BUFSIZ, "%s", path);
+
+    *entry = (Entry){
+        .path  = path,
+        .name  = path,
+        .base  = basename(buffer),
+        .dirfd = AT_FDCWD,
+        .type  = DT_UNKNOWN,
+    };
+}
+
+/**
+ * Fetch lstat information for entry, relative to its parent directory, at
+ * most once per entry.
+ * @param   entry       Pointer to Entry structure
+ * @return  Pointer to cached stat structure or NULL on failure.
+ **/
+struct stat *entry_stat(Entry *entry) {
+    if(!entry->statted){
+        if(fstatat(entry->dirfd, entry->name, &entry->st, AT_SYMLINK_NOFOLLOW) < 0){
+            return NULL;
+        }
+        entry->statted = true;
+    }
+
+    return &entry->st;
+}
+
+/**
+ * Determines if entry is a directory that should be walked, falling back to
+ * the shared lstat when the directory entry type is unknown.
+ * @param   entry       Pointer to Entry structure
+ * @return  true if entry is a directory (symbolic links are not followed).
+ **/
+bool    entry_is_directory(Entry *entry) {
+    if(entry->type != DT_UNKNOWN) return entry->type == DT_DIR;
+
+    struct stat *st = entry_stat(entry);
+    return st && S_ISDIR(st->st_mode);
+}
+
+/* Filter Functions */
+
+/**
+ * Determines if entry has matching file type, using the directory entry type
+ * when the file system provides one and the shared lstat otherwise.
+ * @param   entry       Pointer to Entry structure
  * @param   options     Pointer to options structure
- * @return  true if file at specified path has matching file type specified in
- * options.
+ * @return  true if entry has matching file type specified in options.
  **/
-bool	filter_by_type(const char *path, Options *options) {
-    // Use lstat
-    struct stat file_stat = {0};
-    
-    lstat(path, &file_stat);    
+bool	filter_by_type(Entry *entry, Options *options) {
+    if(entry->type != DT_UNKNOWN){
+        return DTTOIF(entry->type) == options->type;
+    }
+
+    struct stat *st = entry_stat(entry);
     
-    if((file_stat.st_mode & S_IFMT) == options->type) return true;
+    if(st && (st->st_mode & S_IFMT) == options->type) return true;
     else return false;
 }
 
 /**
- * Determines if file at specified path has matching basename.
- * @param   path        Path string
+ * Determines if entry has matching basename, matching the name in place with
+ * the precompiled matcher.
+ * @param   entry       Pointer to Entry structure
  * @param   options     Pointer to options structure
- * @return  true if file at specified path has basename that matches specified
- * pattern in options.
+ * @return  true if entry has basename that matches specified pattern in
+ * options.
  **/
-bool	filter_by_name(const char *path, Options *options) {
-    // Use basename and fnmatch
-    char nonConstPath[BUFSIZ];
-    strcpy(nonConstPath, path);
-    
-    char *filename = basename(nonConstPath);
-    
-    int result = fnmatch(options->name, filename, 0);
-    
-    if(!result) return true;
-    else return false;
+bool	filter_by_name(Entry *entry, Options *options) {
+    return matcher_match(options->matcher, entry->base, strlen(entry->base));
 }
 
 /**
- * Determines if file at specified path has matching access mode.
- * @param   path        Path string
+ * Determines if entry has matching path.
+ * @param   entry       Pointer to Entry structure
  * @param   options     Pointer to options structure
- * @return  true if file at specified path has matching access mode specified
- * in options.
+ * @return  true if entry has full path that matches specified pattern in
+ * options.
  **/
-bool	filter_by_mode(const char *path, Options *options) {
-    // Use access
-    int result = access(path, options->mode);
+bool	filter_by_path(Entry *entry, Options *options) {
+    return matcher_match(options->matcher, entry->path, strlen(entry->path));
+}
+
+/**
+ * Determines if entry has matching access mode.
+ * @param   entry       Pointer to Entry structure
+ * @param   options     Pointer to options structure
+ * @return  true if entry has matching access mode specified in options.
+ **/
+bool	filter_by_mode(Entry *entry, Options *options) {
+    // Use faccessat relative to parent directory
+    int result = faccessat(entry->dirfd, entry->name, options->mode, 0);
     
     if(!result) return true;
     else return false;
     
 }
 
+/**
+ * Compare value against numeric argument the way find does: +N means more
+ * than N, -N less than N, and N exactly N.
+ * @param   value       Value of entry
+ * @param   options     Pointer to options structure
+ * @return  true if value satisfies comparison in options.
+ **/
+static bool compare_number(long long value, Options *options) {
+    if(options->compare > 0) return value > options->number;
+    if(options->compare < 0) return value < options->number;
+    return value == options->number;
+}
+
+/**
+ * Determines if entry has matching size, counted in units rounded up (so
+ * -size -1k only matches empty files, as with find).
+ * @param   entry       Pointer to Entry structure
+ * @param   options     Pointer to options structure
+ * @return  true if entry size satisfies comparison in options.
+ **/
+bool	filter_by_size(Entry *entry, Options *options) {
+    struct stat *st = entry_stat(entry);
+    if(!st) return false;
+
+    long long units = (st->st_size + options->unit - 1) / options->unit;
+    return compare_number(units, options);
+}
+
+/**
+ * Determines if entry was modified the given number of days ago, counting
+ * whole 24 hour periods before the time the search started.
+ * @param   entry       Pointer to Entry structure
+ * @param   options     Pointer to options structure
+ * @return  true if entry age in days satisfies comparison in options.
+ **/
+bool	filter_by_mtime(Entry *entry, Options *options) {
+    struct stat *st = entry_stat(entry);
+    if(!st) return false;
+
+    long long age  = (long long)options->time.tv_sec - st->st_mtim.tv_sec;
+    long long days = age >= 0 ? age / 86400 : -((-age + 86399) / 86400);
+    return compare_number(days, options);
+}
+
+/**
+ * Determines if entry was modified more recently than the reference file.
+ * @param   entry       Pointer to Entry structure
+ * @param   options     Pointer to options structure
+ * @return  true if entry mtime is later than reference time in options.
+ **/
+bool	filter_by_newer(Entry *entry, Options *options) {
+    struct stat *st = entry_stat(entry);
+    if(!st) return false;
+
+    if(st->st_mtim.tv_sec != options->time.tv_sec){
+        return st->st_mtim.tv_sec > options->time.tv_sec;
+    }
+    return st->st_mtim.tv_nsec > options->time.tv_nsec;
+}
+
+/**
+ * Marks entry so that the walker does not descend into it. Always true.
+ * @param   entry       Pointer to Entry structure
+ * @param   options     Pointer to options structure
+ * @return  true
+ **/
+bool	filter_prune(Entry *entry, Options *options) {
+    (void)options;
+    entry->prune = true;
+    return true;
+}
+
 /* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -3,6 +3,7 @@
 #include "findit.h"
 
 #include <dirent.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,83 +22,37 @@
  * @param   status      Exit status
  **/
 void usage(int status) {
-    fprintf(stderr, "Usage: findit PATH [OPTIONS]\n\n");
-    fprintf(stderr, "Options:\n\n");
-    fprintf(stderr, "   -type [f|d]	File is of type f for regular file or d for directory\n");
+    fprintf(stderr, "Usage: findit PATH [OPTIONS] [EXPRESSION]\n\n");
+    fprintf(stderr, "Expression:\n\n");
+    fprintf(stderr, "   ( EXPR )	Group expressions\n");
+    fprintf(stderr, "   ! EXPR	Expression is false (also -not)\n");
+    fprintf(stderr, "   EXPR -a EXPR	Both expressions are true (also -and or juxtaposition)\n");
+    fprintf(stderr, "   EXPR -o EXPR	Either expression is true (also -or)\n");
+    fprintf(stderr, "   -type [fdlbcps]	File is of type f for regular file, d for directory, l for symbolic link, ...\n");
     fprintf(stderr, "   -name pattern	Name of file matches shell pattern\n");
+    fprintf(stderr, "   -iname pattern	Like -name, but ignoring case\n");
+    fprintf(stderr, "   -regex pattern	Whole path matches extended regular expression\n");
+    fprintf(stderr, "   -iregex pattern	Like -regex, but ignoring case\n");
     fprintf(stderr, "   -executable	File is executable or directory is searchable by user\n");
     fprintf(stderr, "   -readable	File is readable by user\n");
     fprintf(stderr, "   -writable	File is writable by user\n");
+    fprintf(stderr, "   -size [+-]N[bcwkMG]	File uses more than, less than or exactly N units of space\n");
+    fprintf(stderr, "   -mtime [+-]N	File was last modified more than, less than or exactly N days ago\n");
+    fprintf(stderr, "   -newer file	File was modified more recently than file\n");
+    fprintf(stderr, "   -prune	Do not descend into directory (always true)\n");
+    fprintf(stderr, "\nOptions:\n\n");
+    fprintf(stderr, "   -j jobs	Walk directories on jobs worker threads\n");
+    fprintf(stderr, "   -sorted	Output paths in deterministic (sorted) order\n");
+    fprintf(stderr, "   -uring	Batch metadata lookups through io_uring when available\n");
+    fprintf(stderr, "   -mindepth N	Do not apply tests at depths less than N\n");
+    fprintf(stderr, "   -maxdepth N	Descend at most N directory levels below PATH\n");
+    fprintf(stderr, "   -xdev	Do not descend into directories on other file systems\n");
+    fprintf(stderr, "   -print0	Terminate each path with a NUL character instead of a newline\n");
+    fprintf(stderr, "   -update-index file	Create or incrementally refresh index of PATH in file\n");
+    fprintf(stderr, "   -index file	Query snapshot of PATH (or the whole index) in index file instead of walking it\n");
     exit(status);
 }
 
-/**
- * Recursively walk specified directory, adding all file system entities to
- * specified files list.
- * @param   root        Directory to walk
- * @param   files       List of files found
- **/
-void	find_files(const char *root, List *files) {
-    // Add root to files
-
-    // Walk directory
-    //  - Skip current and parent directory entries
-    //  - Form full path to entry
-    //  - Recursively walk directories or add entry to files list
-    
-    Data root_data;
-    root_data.string = strdup(root);
-    
-    list_append(files, root_data);
-    
-    DIR *d = opendir(root);
-    if (!d){
-        perror("opendir");
-        return;
-    }
-    
-    struct dirent *e;
-    while ((e = readdir(d)) != NULL){
-        
-        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0){
-            continue;
-        }
-        
-        char path[BUFSIZ];
-        snprintf(path, BUFSIZ, "%s/%s", root, e->d_name);
-        
-        if (e->d_type == DT_DIR){
-            find_files(path, files);
-        }
-        
-        else{
-            Data data;
-            data.string = strdup(path);
-            if (data.string) {
-                list_append(files, data);
-            }
-        }
-    }
-    
-    closedir(d);
-}
-    
-/**
- * Iteratively filter list of files with each filter in list of filters.
- * @param   files       List of files
- * @param   filters     List of filters
- * @param   options     Pointer to options structure
- **/
-void	filter_files(List *files, List *filters, Options *options) {
-    // Apply each filter to list of files
-    Node *currFilter = filters->head;
-    
-    while(currFilter){
-        list_filter(files, currFilter->data.function, options, true);
-        currFilter = currFilter->next;
-    }
-}
-
 void print_song() {
     char song[] = "Now we are running in a pack to the place you don't know\n"
     "And I want you to know that I'll always be around\n"
@@ -146,43 +101,61 @@ int main(int argc, char *argv[]) {
     // Parse command line arguments */
     
     List files = {0};
-    List filters = {0};
-    Options options = {0};
-    Data data = {0};
-    char root[BUFSIZ];
+    Program program;
+    char **tokens = calloc(argc, sizeof(char *));
+    size_t ntokens = 0;
+    char root[BUFSIZ] = "";
+    char *update = NULL;
+    char *index = NULL;
+    Settings settings = {.program = &program, .jobs = 1, .maxdepth = SIZE_MAX, .delimiter = '\n'};
     
     if(argc == 1) usage(1);
     
     for(int i=1; i<argc; i++){
-        if(strcmp(argv[i], "-type") == 0){
-            data.function = filter_by_type;
-            list_append(&filters, data);
-            i++;
+        int arity = program_arity(argv[i]);
 
-            if(strcmp(argv[i], "f") == 0) options.type = S_IFREG;
-    
-            else if(strcmp(argv[i], "d") == 0) options.type = S_IFDIR;
+        if(arity >= 0){
+            // Expression tokens (and their arguments) are compiled below
+            if(i + arity >= argc) usage(1);
+            for(int j = 0; j <= arity; j++){
+                tokens[ntokens++] = argv[i + j];
+            }
+            i += arity;
+        }
+        else if(strcmp(argv[i], "-j") == 0){
+            if(i + 1 >= argc) usage(1);
+            long n = strtol(argv[++i], NULL, 10);
+            if(n < 1) usage(1);
+            settings.jobs = n;
         }
-        else if(strcmp(argv[i], "-name") == 0){
-            options.name = argv[i+1];
+        else if(strcmp(argv[i], "-sorted") == 0){
+            settings.sorted = true;
+        }
+        else if(strcmp(argv[i], "-uring") == 0){
+            settings.uring = true;
+        }
+        else if(strcmp(argv[i], "-mindepth") == 0 || strcmp(argv[i], "-maxdepth") == 0){
+            if(i + 1 >= argc) usage(1);
+            char *end;
+            long n = strtol(argv[i + 1], &end, 10);
+            if(n < 0 || end == argv[i + 1] || *end) usage(1);
+            if(argv[i][2] == 'i') settings.mindepth = n;
+            else settings.maxdepth = n;
             i++;
-            data.function = filter_by_name;
-            list_append(&filters, data);
         }
-        else if(strcmp(argv[i], "-executable") == 0){
-            options.mode |= 0x1;
-            data.function = filter_by_mode;
-            list_append(&filters, data);
+        else if(strcmp(argv[i], "-xdev") == 0){
+            settings.xdev = true;
         }
-        else if(strcmp(argv[i], "-writable") == 0){
-            options.mode |= 0x2;
-            data.function = filter_by_mode;
-            list_append(&filters, data);
+        else if(strcmp(argv[i], "-print0") == 0){
+            settings.delimiter = '\0';
         }
-        else if(strcmp(argv[i], "-readable") == 0){
-            options.mode |= 0x4;
-            data.function = filter_by_mode;
-            list_append(&filters, data);
+        else if(strcmp(argv[i], "-update-index") == 0){
+            if(i + 1 >= argc) usage(1);
+            update = argv[++i];
+        }
+        else if(strcmp(argv[i], "-index") == 0){
+            if(i + 1 >= argc) usage(1);
+            index = argv[++i];
         }
         else if(strcmp(argv[i], "luke") == 0){
             printf("Congratulations! You found the hidden Easter Egg. Here's High and Low by Empire of the Sun\n\n");
@@ -194,16 +167,42 @@ int main(int argc, char *argv[]) {
         }
     }
     
-    // Find files, filter files, print files
+    if(!root[0] && (update || !index)) usage(1);
+    if(index && settings.xdev){
+        // Devices are not stored in the index
+        fprintf(stderr, "findit: -xdev cannot be used with -index\n");
+        return EXIT_FAILURE;
+    }
+    if(!program_compile(&program, tokens, ntokens)) usage(1);
+    
+    int status = EXIT_SUCCESS;
     
-    find_files(root, &files);
-    filter_files(&files, &filters, &options);
-    list_output(&files, stdout);
+    if(update || index){
+        // Refresh and/or query the on-disk snapshot; records are stored in
+        // sorted order, so query output needs no sorting
+        if(update && !index_update(update, root)) status = EXIT_FAILURE;
+        else if(index && !index_query(index, root, &settings)) status = EXIT_FAILURE;
+    }
+    else if(settings.jobs == 1 || !settings.sorted){
+        // Find files, filtering and printing each one as it is discovered
+        find_files(root, &settings, NULL);
+    }
+    else{
+        // Parallel workers finish in arbitrary order, so only matching paths
+        // are collected and then sorted
+        find_files(root, &settings, &files);
+        Output output;
+        output_init(&output, STDOUT_FILENO, 0, settings.delimiter, NULL);
+        list_sort(&files, path_compare);
+        list_output(&files, &output);
+        output_delete(&output);
+    }
     
-    node_delete(files.head, true, true);
-    node_delete(filters.head, false, true);
+    list_delete(&files);
+    program_delete(&program);
+    free(tokens);
     
-    return EXIT_SUCCESS;
+    return status;
 }
 
 /* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
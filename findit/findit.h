@@ -2,30 +2,99 @@
 
 #pragma once
 
+#include "output.h"
+
 #include <stdbool.h>
 #include <stdio.h>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* Entry Structure */
+
+typedef struct {
+    const char   *path;     // Full path (for output)
+    const char   *name;     // Path relative to dirfd (for system calls)
+    const char   *base;     // Base name (for name matching)
+    int           dirfd;    // Parent directory file descriptor (or AT_FDCWD)
+    unsigned char type;     // Directory entry type (DT_UNKNOWN if not known)
+    bool          statted;  // Whether st holds the result of lstat
+    bool          prune;    // Whether not to descend into entry (-prune)
+    struct stat   st;       // Cached lstat result shared by all filters
+} Entry;
+
+void    entry_init(Entry *entry, const char *path, char *buffer);
+struct stat *entry_stat(Entry *entry);
+bool    entry_is_directory(Entry *entry);
+
+/* Matcher Structure */
+
+#define MATCHER_FOLD    (1<<0)  // Ignore case
+#define MATCHER_REGEX   (1<<1)  // Pattern is a regular expression
+
+typedef struct Matcher Matcher;
+
+Matcher *matcher_create(const char *pattern, int flags);
+bool    matcher_match(const Matcher *m, const char *s, size_t n);
+void    matcher_delete(Matcher *m);
+
 /* Options Structure */
 
 typedef struct {
-    int   type;         // File type (-type)
-    char *name;         // File name pattern (-name)
-    int   mode;         // Access modes (-executable, -readable, -writable)
+    int      type;      // File type (-type)
+    Matcher *matcher;   // Compiled pattern (-name, -iname, -regex, -iregex)
+    int      mode;      // Access mode (-executable, -readable, -writable)
+    int      compare;   // Sign of comparison: -1 (-N), 0 (N), 1 (+N)
+    long long number;   // Numeric argument (-size units, -mtime days)
+    long long unit;     // Size of unit in bytes (-size)
+    struct timespec time; // Reference time (-mtime now, -newer file's mtime)
 } Options;
 
 /* Filter Functions */
 
-typedef bool (*Filter)(const char *path, Options *options);
+typedef bool (*Filter)(Entry *entry, Options *options);
+
+bool	filter_by_type(Entry *entry, Options *options);
+bool	filter_by_name(Entry *entry, Options *options);
+bool	filter_by_path(Entry *entry, Options *options);
+bool	filter_by_mode(Entry *entry, Options *options);
+bool	filter_by_size(Entry *entry, Options *options);
+bool	filter_by_mtime(Entry *entry, Options *options);
+bool	filter_by_newer(Entry *entry, Options *options);
+bool	filter_prune(Entry *entry, Options *options);
+
+/* Arena Structure */
 
-bool	filter_by_type(const char *path, Options *options);
-bool	filter_by_name(const char *path, Options *options);
-bool	filter_by_mode(const char *path, Options *options);
+typedef struct Chunk Chunk;
+
+typedef struct {
+    Chunk  *chunks;     // Chunks allocated so far (most recent first)
+    char   *next;       // Next free byte in current chunk
+    char   *end;        // End of current chunk
+} Arena;
+
+void *  arena_alloc(Arena *a, size_t size);
+void    arena_concat(Arena *a, Arena *other);
+void    arena_delete(Arena *a);
+
+/* Path Structure */
+
+typedef struct Path Path;
+struct Path {
+    const Path *parent; // Parent directory (NULL for root)
+    size_t      depth;  // Number of ancestors
+    size_t      length; // Length of full path
+    char        name[]; // Last component (whole root path for root)
+};
+
+Path *  path_create(Arena *a, const Path *parent, const char *name);
+bool    path_format(const Path *p, char *buffer, size_t size);
+int     path_compare(const Path *a, const Path *b);
 
 /* Data Union */
 
 typedef union {
-    char *  string;     // String data
-    Filter  function;   // Filter function
+    Path *  path;       // Path data
 } Data;
 
 /* Node Structure */
@@ -36,18 +105,79 @@ struct Node {
     Node   *next;       // Pointer to next Node
 };
 
-Node *  node_create(Data data, Node *next);
-void    node_delete(Node *n, bool release, bool recursive);
-
 /* List Structure */
 
 typedef struct {
     Node   *head;       // Pointer to first Node
     Node   *tail;       // Pointer to last Node
+    Arena   arena;      // Storage for Nodes and Paths
 } List;
 
 void    list_append(List *l, Data data);
-void    list_filter(List *l, Filter filter, Options *options, bool release);
-void    list_output(List *l, FILE *stream);
+void    list_output(List *l, Output *o);
+void    list_sort(List *l, int (*compare)(const Path *, const Path *));
+void    list_concat(List *l, List *other);
+void    list_delete(List *l);
+
+/* Program Structure */
+
+#define PROGRAM_ACCEPT  ((size_t)-1)    // Jump target: entry matches
+#define PROGRAM_REJECT  ((size_t)-2)    // Jump target: entry does not match
+
+typedef enum {
+    STAT_NEVER,         // Predicate never needs lstat
+    STAT_UNTYPED,       // Predicate needs lstat only if d_type is unknown
+    STAT_ALWAYS,        // Predicate always needs lstat
+} StatNeed;
+
+typedef struct {
+    Filter   filter;    // Predicate function
+    Options  options;   // Predicate arguments
+    StatNeed stat;      // When predicate needs the entry's lstat
+    size_t   on_true;   // Next instruction if predicate holds
+    size_t   on_false;  // Next instruction if predicate fails
+} Instruction;
+
+typedef struct {
+    Instruction *code;  // Array of instructions
+    size_t       size;  // Number of instructions
+    size_t       start; // Index of first instruction (or jump target)
+} Program;
+
+int     program_arity(const char *token);
+bool    program_compile(Program *program, char **tokens, size_t ntokens);
+bool    program_run(const Program *program, Entry *entry);
+size_t  program_resume(const Program *program, Entry *entry, size_t pc, bool defer);
+void    program_delete(Program *program);
+
+/* Ring Functions */
+
+typedef struct Ring Ring;
+
+Ring *  ring_create(unsigned depth);
+void    ring_delete(Ring *ring);
+bool    ring_stat(Ring *ring, Entry **entries, size_t n);
+
+/* Settings Structure */
+
+typedef struct {
+    Program *program;   // Filter program
+    size_t   jobs;      // Number of worker threads (-j)
+    bool     sorted;    // Deterministic output order (-sorted)
+    bool     uring;     // Batch lstat calls through io_uring (-uring)
+    size_t   mindepth;  // Shallowest depth to evaluate (-mindepth)
+    size_t   maxdepth;  // Deepest depth to visit (-maxdepth)
+    bool     xdev;      // Stay on root's file system (-xdev)
+    char     delimiter; // Output record terminator ('\0' with -print0)
+} Settings;
+
+/* Index Functions */
+
+bool    index_update(const char *file, const char *root);
+bool    index_query(const char *file, const char *root, Settings *settings);
+
+/* Walker Functions */
+
+void    find_files(const char *root, Settings *settings, List *files);
 
 /* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
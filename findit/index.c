@@ -0,0 +1,599 @@
+/* index.c: Persistent on-disk snapshot of a directory tree */
+
+#define _GNU_SOURCE  // scandirat
+
+#include "findit.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * Index file format (all integers are LEB128 varints):
+ *
+ *   "FINDITX1"  root-length  root  count
+ *   count records, in depth-first order with each directory's entries
+ *   sorted by name:
+ *     prefix      bytes shared with previous path
+ *     suffix-length, suffix
+ *     type        d_type (one byte)
+ *     mode        st_mode
+ *     mtime       seconds (zigzag), nanoseconds
+ *     size        st_size
+ *     subtree     number of records below this one (directories)
+ */
+
+/* Constants */
+
+#define INDEX_MAGIC     "FINDITX1"
+#define INDEX_MAGIC_LEN 8
+#define NONE            ((size_t)-1)
+
+/* Record Structure */
+
+typedef struct {
+    size_t      path;       // Offset of path in string buffer
+    size_t      length;     // Length of path
+    size_t      name;       // Offset of base name within path
+    uint8_t     type;       // Directory entry type (DT_*)
+    uint32_t    mode;       // File mode
+    int64_t     mtime;      // Modification time (seconds)
+    uint32_t    mtime_nsec; // Modification time (nanoseconds)
+    int64_t     size;       // File size
+    size_t      subtree;    // Number of descendant records
+} Record;
+
+/* Snapshot Structure */
+
+typedef struct {
+    Record     *records;    // Records in index order
+    size_t      count;      // Number of records
+    size_t      capacity;   // Capacity of records array
+    char       *strings;    // Path storage
+    size_t      used;       // Bytes used in path storage
+    size_t      size;       // Capacity of path storage
+} Snapshot;
+
+/* Encoding Functions */
+
+/**
+ * Write unsigned integer as LEB128 varint.
+ * @param   stream      File stream
+ * @param   value       Value to write
+ **/
+static void put_varint(FILE *stream, uint64_t value) {
+    while(value >= 0x80){
+        putc_unlocked((value & 0x7f) | 0x80, stream);
+        value >>= 7;
+    }
+    putc_unlocked(value, stream);
+}
+
+/**
+ * Read LEB128 varint.
+ * @param   p           Pointer to read position (advanced)
+ * @param   end         End of input
+ * @param   value       Pointer to value to set
+ * @return  true on success, false if input is truncated or malformed.
+ **/
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *value) {
+    *value = 0;
+
+    for(int shift = 0; shift < 64; shift += 7){
+        if(*p >= end) return false;
+
+        uint8_t byte = *(*p)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+/* Snapshot Functions */
+
+/**
+ * Append record for path to snapshot.
+ * @param   s           Pointer to Snapshot structure
+ * @param   path        Path string
+ * @param   st          Pointer to lstat result for path
+ * @return  Index of new record.
+ **/
+static size_t snapshot_add(Snapshot *s, const char *path, const struct stat *st) {
+    size_t length = strlen(path);
+
+    if(s->count == s->capacity){
+        s->capacity = s->capacity ? 2*s->capacity : 1024;
+        s->records  = realloc(s->records, s->capacity * sizeof(Record));
+    }
+    if(s->used + length + 1 > s->size){
+        s->size    = 2*(s->used + length + 1);
+        s->strings = realloc(s->strings, s->size);
+    }
+    memcpy(s->strings + s->used, path, length + 1);
+
+    const char *slash = strrchr(path, '/');
+    s->records[s->count] = (Record){
+        .path       = s->used,
+        .length     = length,
+        .name       = slash && s->count ? slash - path + 1 : 0,
+        .type       = IFTODT(st->st_mode),
+        .mode       = st->st_mode,
+        .mtime      = st->st_mtim.tv_sec,
+        .mtime_nsec = st->st_mtim.tv_nsec,
+        .size       = st->st_size,
+    };
+    s->used += length + 1;
+    return s->count++;
+}
+
+/**
+ * Release snapshot storage.
+ * @param   s           Pointer to Snapshot structure
+ **/
+static void snapshot_delete(Snapshot *s) {
+    free(s->records);
+    free(s->strings);
+    *s = (Snapshot){0};
+}
+
+/* Index File Functions */
+
+/**
+ * Map index file and validate its header.
+ * @param   file        Index file path
+ * @param   size        Pointer to set to size of mapping
+ * @param   root        Pointer to set to root path stored in index (must be
+ * freed)
+ * @param   count       Pointer to set to number of records
+ * @param   records     Pointer to set to start of records
+ * @return  Pointer to mapping (must be unmapped) or NULL on error.
+ **/
+static const uint8_t *index_map(const char *file, size_t *size, char **root, uint64_t *count, const uint8_t **records) {
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size < INDEX_MAGIC_LEN){
+        close(fd);
+        return NULL;
+    }
+
+    const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return NULL;
+
+    const uint8_t *p   = map + INDEX_MAGIC_LEN;
+    const uint8_t *end = map + st.st_size;
+    uint64_t length;
+
+    if(memcmp(map, INDEX_MAGIC, INDEX_MAGIC_LEN) != 0 ||
+       !get_varint(&p, end, &length) || length > (uint64_t)(end - p)){
+        munmap((void *)map, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    *root = strndup((const char *)p, length);
+    p += length;
+
+    if(!get_varint(&p, end, count)){
+        free(*root);
+        munmap((void *)map, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+    *size    = st.st_size;
+    *records = p;
+    return map;
+}
+
+/**
+ * Decode next record, rebuilding its front-coded path in buffer.
+ * @param   p           Pointer to read position (advanced)
+ * @param   end         End of records
+ * @param   path        Path buffer of BUFSIZ bytes holding previous path
+ * @param   length      Pointer to length of previous path (updated)
+ * @param   record      Pointer to Record structure to fill (path fields are
+ * left unset)
+ * @return  true on success, false if index is corrupt.
+ **/
+static bool index_decode(const uint8_t **p, const uint8_t *end, char *path, size_t *length, Record *record) {
+    uint64_t prefix, suffix, mode, mtime, nsec, size, subtree;
+
+    if(!get_varint(p, end, &prefix) || prefix > *length ||
+       !get_varint(p, end, &suffix) || suffix > (uint64_t)(end - *p) ||
+       prefix + suffix >= BUFSIZ){
+        return false;
+    }
+
+    memcpy(path + prefix, *p, suffix);
+    *p += suffix;
+    *length = prefix + suffix;
+    path[*length] = 0;
+
+    if(*p >= end) return false;
+    record->type = *(*p)++;
+
+    if(!get_varint(p, end, &mode) || !get_varint(p, end, &mtime) ||
+       !get_varint(p, end, &nsec) || !get_varint(p, end, &size) ||
+       !get_varint(p, end, &subtree)){
+        return false;
+    }
+
+    record->mode       = mode;
+    record->mtime      = (int64_t)(mtime >> 1) ^ -(int64_t)(mtime & 1);
+    record->mtime_nsec = nsec;
+    record->size       = size;
+    record->subtree    = subtree;
+    return true;
+}
+
+/**
+ * Load existing index into snapshot.
+ * @param   s           Pointer to Snapshot structure to fill
+ * @param   file        Index file path
+ * @param   root        Root path the index must describe
+ * @return  true if index exists, is valid, and describes root.
+ **/
+static bool snapshot_load(Snapshot *s, const char *file, const char *root) {
+    size_t size;
+    char *stored;
+    uint64_t count;
+    const uint8_t *p;
+    const uint8_t *map = index_map(file, &size, &stored, &count, &p);
+    if(!map) return false;
+
+    bool valid = strcmp(stored, root) == 0;
+    char path[BUFSIZ];
+    size_t length = 0;
+
+    for(uint64_t i = 0; valid && i < count; i++){
+        Record record;
+        if(!(valid = index_decode(&p, map + size, path, &length, &record))) break;
+
+        struct stat st = {
+            .st_mode = record.mode,
+            .st_size = record.size,
+            .st_mtim = {record.mtime, record.mtime_nsec},
+        };
+        size_t added = snapshot_add(s, path, &st);
+        s->records[added].subtree = record.subtree;
+    }
+
+    free(stored);
+    munmap((void *)map, size);
+    if(!valid) snapshot_delete(s);
+    return valid;
+}
+
+/**
+ * Write snapshot to index file atomically (via a temporary file).
+ * @param   s           Pointer to Snapshot structure
+ * @param   file        Index file path
+ * @param   root        Root path of snapshot
+ * @return  true on success.
+ **/
+static bool snapshot_save(const Snapshot *s, const char *file, const char *root) {
+    char temporary[BUFSIZ];
+    snprintf(temporary, BUFSIZ, "%s.tmp", file);
+
+    FILE *stream = fopen(temporary, "w");
+    if(!stream) return false;
+
+    fwrite(INDEX_MAGIC, 1, INDEX_MAGIC_LEN, stream);
+    put_varint(stream, strlen(root));
+    fwrite(root, 1, strlen(root), stream);
+    put_varint(stream, s->count);
+
+    const char *previous = "";
+    size_t previous_length = 0;
+
+    for(size_t i = 0; i < s->count; i++){
+        const Record *r = &s->records[i];
+        const char *path = s->strings + r->path;
+
+        size_t prefix = 0;
+        while(prefix < previous_length && prefix < r->length && previous[prefix] == path[prefix]){
+            prefix++;
+        }
+
+        put_varint(stream, prefix);
+        put_varint(stream, r->length - prefix);
+        fwrite(path + prefix, 1, r->length - prefix, stream);
+        putc_unlocked(r->type, stream);
+        put_varint(stream, r->mode);
+        put_varint(stream, ((uint64_t)r->mtime << 1) ^ (uint64_t)(r->mtime >> 63));
+        put_varint(stream, r->mtime_nsec);
+        put_varint(stream, r->size);
+        put_varint(stream, r->subtree);
+
+        previous = path;
+        previous_length = r->length;
+    }
+
+    if(fclose(stream) != 0 || rename(temporary, file) < 0){
+        unlink(temporary);
+        return false;
+    }
+    return true;
+}
+
+/* Scan Functions */
+
+static void index_scan(Snapshot *s, const Snapshot *old, size_t previous, int fd, const char *path, const struct stat *st);
+
+/**
+ * Add entry of directory to snapshot, descending into it if it is a
+ * directory.
+ * @param   s           Pointer to Snapshot structure
+ * @param   old         Pointer to previous Snapshot structure
+ * @param   previous    Index of entry in old snapshot (or NONE)
+ * @param   fd          Parent directory file descriptor
+ * @param   name        Entry name
+ * @param   root        Parent directory path
+ **/
+static void index_entry(Snapshot *s, const Snapshot *old, size_t previous, int fd, const char *name, const char *root) {
+    char path[BUFSIZ];
+    snprintf(path, BUFSIZ, "%s/%s", root, name);
+
+    struct stat st;
+    if(fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0){
+        perror("fstatat");
+        return;
+    }
+
+    if(!S_ISDIR(st.st_mode)){
+        snapshot_add(s, path, &st);
+        return;
+    }
+
+    int child = openat(fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(child < 0){
+        // Keep unreadable directories as leaves
+        perror("opendir");
+        snapshot_add(s, path, &st);
+        return;
+    }
+    index_scan(s, old, previous, child, path, &st);
+}
+
+/**
+ * Add directory and its subtree to snapshot. If the directory's mtime matches
+ * the old snapshot, its list of names cannot have changed: names are taken
+ * from the old snapshot instead of reading the directory again. Every entry
+ * is still stat'ed, since a file rewritten in place changes its size and
+ * mtime but not its directory's.
+ * @param   s           Pointer to Snapshot structure
+ * @param   old         Pointer to previous Snapshot structure
+ * @param   previous    Index of directory in old snapshot (or NONE)
+ * @param   fd          Directory file descriptor (ownership is transferred)
+ * @param   path        Directory path
+ * @param   st          Pointer to lstat result for directory
+ **/
+static void index_scan(Snapshot *s, const Snapshot *old, size_t previous, int fd, const char *path, const struct stat *st) {
+    size_t self = snapshot_add(s, path, st);
+    const Record *r = previous == NONE ? NULL : &old->records[previous];
+
+    // Children of an old directory are the records following it, each
+    // followed by its own subtree
+    size_t child = previous + 1;
+    size_t last  = r ? previous + 1 + r->subtree : 0;
+
+    if(r && r->type == DT_DIR && r->mtime == st->st_mtim.tv_sec && r->mtime_nsec == st->st_mtim.tv_nsec){
+        for(; child < last; child += 1 + old->records[child].subtree){
+            const Record *c = &old->records[child];
+            index_entry(s, old, child, fd, old->strings + c->path + c->name, path);
+        }
+    }
+    else{
+        struct dirent **entries;
+        int nentries = scandirat(fd, ".", &entries, NULL, alphasort);
+        if(nentries < 0) perror("scandir");
+
+        for(int i = 0; i < nentries; i++){
+            const char *name = entries[i]->d_name;
+            if(strcmp(name, ".") != 0 && strcmp(name, "..") != 0){
+                // Old children are sorted the same way, so matching is a merge
+                while(child < last && strcmp(old->strings + old->records[child].path + old->records[child].name, name) < 0){
+                    child += 1 + old->records[child].subtree;
+                }
+                bool same = child < last && strcmp(old->strings + old->records[child].path + old->records[child].name, name) == 0;
+
+                index_entry(s, old, same ? child : NONE, fd, name, path);
+            }
+            free(entries[i]);
+        }
+        if(nentries >= 0) free(entries);
+    }
+
+    close(fd);
+    s->records[self].subtree = s->count - self - 1;
+}
+
+/**
+ * Find where path lies in an index of stored: its real path must be the
+ * real path of stored or below it, and its records are named from stored.
+ * @param   path        Path given on the command line
+ * @param   stored      Root path stored in index
+ * @param   scope       Buffer of BUFSIZ bytes for the indexed path of path
+ * @return  true if path is inside the indexed tree.
+ **/
+static bool index_scope(const char *path, const char *stored, char *scope) {
+    char *real = realpath(path, NULL);
+    char *base = realpath(stored, NULL);
+    const char *rest = NULL;
+
+    if(!real || !base){
+        perror(real ? stored : path);
+    }
+    else if(strcmp(base, "/") == 0){
+        rest = strcmp(real, "/") == 0 ? "" : real;
+    }
+    else{
+        size_t n = strlen(base);
+        if(strncmp(real, base, n) == 0 && (real[n] == '/' || !real[n])) rest = real + n;
+        else fprintf(stderr, "findit: %s: not under indexed root %s\n", path, stored);
+    }
+
+    if(rest) snprintf(scope, BUFSIZ, "%s%s", stored, rest);
+    free(real);
+    free(base);
+    return rest != NULL;
+}
+
+/* Index Functions */
+
+/**
+ * Create or incrementally refresh index of tree at root.
+ * @param   file        Index file path
+ * @param   root        Directory to index
+ * @return  true on success.
+ **/
+bool    index_update(const char *file, const char *root) {
+    Snapshot old = {0};
+    Snapshot new = {0};
+
+    bool incremental = snapshot_load(&old, file, root);
+
+    int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0){
+        perror("opendir");
+        if(fd >= 0) close(fd);
+        snapshot_delete(&old);
+        return false;
+    }
+
+    index_scan(&new, &old, incremental ? 0 : NONE, fd, root, &st);
+
+    bool saved = snapshot_save(&new, file, root);
+    if(!saved) perror(file);
+
+    snapshot_delete(&old);
+    snapshot_delete(&new);
+    return saved;
+}
+
+/**
+ * Run filter program against the records of index under path (the whole
+ * index if path is empty), printing matches in index (sorted) order and
+ * named from path as given. Metadata predicates use the stored lstat fields;
+ * access checks still consult the live file system. Depth limits and -prune
+ * skip subtrees using the stored subtree counts. Devices are not recorded,
+ * so -xdev cannot be used.
+ * @param   file        Index file path
+ * @param   root        Directory to search, inside the indexed root (or "")
+ * @param   settings    Pointer to Settings structure
+ * @return  true on success.
+ **/
+bool    index_query(const char *file, const char *root, Settings *settings) {
+    size_t size;
+    char *stored;
+    uint64_t count;
+    const uint8_t *p;
+    const uint8_t *map = index_map(file, &size, &stored, &count, &p);
+    if(!map){
+        perror(file);
+        return false;
+    }
+
+    // Records of path start with scope; they are shown starting with path
+    char scope[BUFSIZ];
+    if(!root[0]) root = stored;
+    if(!index_scope(root, stored, scope)){
+        free(stored);
+        munmap((void *)map, size);
+        return false;
+    }
+    size_t nscope = strlen(scope);
+    size_t nroot  = strlen(root);
+
+    char path[BUFSIZ];
+    char shown[2*BUFSIZ];   // root and the rest of path both fit
+    size_t length = 0;
+    bool valid = true;
+    bool found = false;
+    uint64_t stop = count;
+    Output output;
+    output_init(&output, STDOUT_FILENO, 0, settings->delimiter, NULL);
+
+    // Stack of records at which each open ancestor's subtree ends; its
+    // height is the depth of the current record
+    uint64_t *ends = NULL;
+    size_t depth = 0;
+    size_t capacity = 0;
+    uint64_t skip = 0;
+
+    for(uint64_t i = 0; i < count; i++){
+        Record record;
+        if(!(valid = index_decode(&p, map + size, path, &length, &record))){
+            fprintf(stderr, "findit: %s: corrupt index\n", file);
+            break;
+        }
+
+        // Records before path's are only decoded; its subtree ends the query
+        if(!found){
+            if(length != nscope || memcmp(path, scope, length) != 0) continue;
+            found = true;
+            stop  = i + 1 + record.subtree;
+        }
+        if(i >= stop) break;
+
+        while(depth && ends[depth - 1] <= i) depth--;
+        if(i < skip) continue;
+
+        memcpy(shown, root, nroot);
+        memcpy(shown + nroot, path + nscope, length - nscope + 1);
+        size_t nshown = nroot + length - nscope;
+
+        const char *slash = strrchr(shown + nroot, '/');
+        Entry entry = {
+            .path    = shown,
+            .name    = shown,
+            .base    = slash ? slash + 1 : shown,
+            .dirfd   = AT_FDCWD,
+            .type    = record.type,
+            .statted = true,
+            .st      = {
+                .st_mode = record.mode,
+                .st_size = record.size,
+                .st_mtim = {record.mtime, record.mtime_nsec},
+            },
+        };
+
+        if(depth >= settings->mindepth && program_run(settings->program, &entry)){
+            output_record(&output, shown, nshown);
+        }
+
+        if(entry.prune || depth >= settings->maxdepth){
+            skip = i + 1 + record.subtree;
+        }
+        else if(record.subtree){
+            if(depth == capacity){
+                capacity = capacity ? 2*capacity : 64;
+                ends = realloc(ends, capacity * sizeof(uint64_t));
+            }
+            ends[depth++] = i + 1 + record.subtree;
+        }
+    }
+
+    if(valid && !found){
+        fprintf(stderr, "findit: %s: not in index %s\n", root, file);
+        valid = false;
+    }
+
+    output_delete(&output);
+    free(ends);
+    free(stored);
+    munmap((void *)map, size);
+    return valid;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,416 @@
+/* match.c: Precompiled name and path matchers */
+
+#include "findit.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <regex.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Matcher Structure */
+
+typedef enum {
+    MATCH_LITERAL,      // pattern has no wildcards
+    MATCH_PREFIX,       // literal*
+    MATCH_SUFFIX,       // *literal
+    MATCH_CONTAINS,     // *literal*
+    MATCH_GLOB,         // anything else: backtracking glob matcher
+    MATCH_REGEX,        // POSIX extended regular expression
+} MatchKind;
+
+struct Matcher {
+    MatchKind   kind;       // Specialized matching strategy
+    bool        fold;       // Whether matching ignores case
+    char       *literal;    // Literal text (or required substring for globs)
+    size_t      length;     // Length of literal text
+    char       *pattern;    // Glob pattern (MATCH_GLOB)
+    regex_t     regex;      // Compiled regular expression (MATCH_REGEX)
+};
+
+/* Character Functions */
+
+/**
+ * Fold ASCII letter to lower case (other bytes are unchanged, as with
+ * fnmatch's FNM_CASEFOLD in the C locale).
+ * @param   c           Character
+ * @return  Folded character.
+ **/
+static inline unsigned char fold(unsigned char c) {
+    return (unsigned char)(c - 'A') < 26 ? c | 0x20 : c;
+}
+
+/**
+ * Compare two byte ranges for equality.
+ * @param   a           First range
+ * @param   b           Second range (already folded if folded is set)
+ * @param   n           Number of bytes
+ * @param   folded      Whether to ignore case
+ * @return  true if ranges are equal.
+ **/
+static bool match_equal(const char *a, const char *b, size_t n, bool folded) {
+    if(!folded) return memcmp(a, b, n) == 0;
+
+    for(size_t i = 0; i < n; i++){
+        if(fold(a[i]) != (unsigned char)b[i]) return false;
+    }
+    return true;
+}
+
+/**
+ * Find literal in byte range. With SSE2, sixteen candidate positions are
+ * tested at once by comparing the literal's first and last bytes, and only
+ * positions where both match are compared in full.
+ * @param   s           Byte range to search
+ * @param   n           Length of byte range
+ * @param   literal     Literal to find (already folded if folded is set)
+ * @param   m           Length of literal
+ * @param   folded      Whether to ignore case
+ * @return  true if literal occurs in range.
+ **/
+static bool match_find(const char *s, size_t n, const char *literal, size_t m, bool folded) {
+    if(m == 0) return true;
+    if(m > n) return false;
+
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(literal[0]);
+    const __m128i last  = _mm_set1_epi8(literal[m - 1]);
+    const __m128i upper = _mm_set1_epi8('A' - 1);
+    const __m128i lower = _mm_set1_epi8('Z' + 1);
+    const __m128i bit   = _mm_set1_epi8(0x20);
+
+    for(; i + m - 1 + 16 <= n; i += 16){
+        __m128i head = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i tail = _mm_loadu_si128((const __m128i *)(s + i + m - 1));
+
+        if(folded){
+            // Set the 0x20 bit on 'A'..'Z' only (bytes >= 0x80 are negative
+            // as signed and so never fall in range)
+            __m128i h = _mm_and_si128(_mm_cmpgt_epi8(head, upper), _mm_cmplt_epi8(head, lower));
+            __m128i t = _mm_and_si128(_mm_cmpgt_epi8(tail, upper), _mm_cmplt_epi8(tail, lower));
+            head = _mm_or_si128(head, _mm_and_si128(h, bit));
+            tail = _mm_or_si128(tail, _mm_and_si128(t, bit));
+        }
+
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+
+        while(mask){
+            size_t offset = __builtin_ctz(mask);
+            if(match_equal(s + i + offset, literal, m, folded)) return true;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for(; i + m <= n; i++){
+        if(match_equal(s + i, literal, m, folded)) return true;
+    }
+    return false;
+}
+
+/* Glob Functions */
+
+/**
+ * Determine whether pattern character is a wildcard or escape.
+ * @param   c           Pattern character
+ * @return  true for '*', '?', '[' and '\\'.
+ **/
+static inline bool glob_special(char c) {
+    return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+/**
+ * Parse POSIX character class ("[:alpha:]" and the like) inside a bracket
+ * expression.
+ * @param   r           Pointer to '[' that may start a class
+ * @param   test        Pointer to classification function (set if a class)
+ * @return  Position after the closing ":]", or NULL if r starts no known
+ * class.
+ **/
+static const char *glob_class(const char *r, int (**test)(int)) {
+    static const struct {
+        const char *name;
+        int       (*test)(int);
+    } Classes[] = {
+        {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+        {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+        {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+    };
+
+    if(r[0] != '[' || r[1] != ':') return NULL;
+
+    const char *name = r + 2;
+    const char *end  = strstr(name, ":]");
+    if(!end) return NULL;
+
+    for(size_t i = 0; i < sizeof(Classes) / sizeof(Classes[0]); i++){
+        if(strlen(Classes[i].name) == (size_t)(end - name) && strncmp(Classes[i].name, name, end - name) == 0){
+            *test = Classes[i].test;
+            return end + 2;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Match one character against the single-character pattern element at *p
+ * ('?', bracket expression, escaped or literal character), advancing *p past
+ * the element.
+ * @param   p           Pointer to pattern position
+ * @param   c           Character to match
+ * @param   folded      Whether to ignore case (pattern is already folded)
+ * @return  true if character matches element.
+ **/
+static bool glob_one(const char **p, unsigned char c, bool folded) {
+    const char *q = *p;
+    unsigned char k = folded ? fold(c) : c;
+
+    if(*q == '?'){
+        *p = q + 1;
+        return true;
+    }
+
+    if(*q == '['){
+        const char *r = q + 1;
+        bool negate = (*r == '!' || *r == '^');
+        if(negate) r++;
+
+        bool found = false;
+        const char *start = r;
+        while(*r && (*r != ']' || r == start)){
+            int (*test)(int);
+            const char *after = glob_class(r, &test);
+            if(after){
+                // Ignoring case, upper and lower match any letter
+                if(test(c) || (folded && (test(tolower(c)) || test(toupper(c))))) found = true;
+                r = after;
+                continue;
+            }
+
+            unsigned char lo = *r++;
+            if(lo == '\\' && *r) lo = *r++;
+            unsigned char hi = lo;
+            if(*r == '-' && r[1] && r[1] != ']'){
+                r++;
+                hi = *r++;
+                if(hi == '\\' && *r) hi = *r++;
+            }
+            if(lo <= k && k <= hi) found = true;
+            if(folded && lo <= c && c <= hi) found = true;
+        }
+
+        if(*r == ']'){
+            *p = r + 1;
+            return found != negate;
+        }
+        // Unterminated bracket: '[' is an ordinary character
+    }
+
+    if(*q == '\\'){
+        // A trailing backslash escapes nothing and never matches (as in fnmatch)
+        if(!q[1]){
+            *p = q + 1;
+            return false;
+        }
+        q++;
+    }
+    *p = q + 1;
+    return (unsigned char)*q == k;
+}
+
+/**
+ * Match string against glob pattern. Only the most recent '*' is ever
+ * revisited, so matching takes at most O(n*m) steps and usually O(n).
+ * @param   pattern     Glob pattern (folded if folded is set)
+ * @param   s           String to match
+ * @param   n           Length of string
+ * @param   folded      Whether to ignore case
+ * @return  true if whole string matches pattern.
+ **/
+static bool glob_match(const char *pattern, const char *s, size_t n, bool folded) {
+    const char *p = pattern;
+    const char *star = NULL;
+    size_t      resume = 0;
+    size_t      i = 0;
+
+    while(i < n){
+        if(*p == '*'){
+            star   = ++p;
+            resume = i;
+            continue;
+        }
+
+        const char *next = p;
+        if(*p && glob_one(&next, s[i], folded)){
+            p = next;
+            i++;
+            continue;
+        }
+
+        if(!star) return false;
+        p = star;
+        i = ++resume;
+    }
+
+    while(*p == '*') p++;
+    return *p == 0;
+}
+
+/* Matcher Functions */
+
+/**
+ * Compile pattern into a matcher specialized for its shape.
+ * @param   pattern     Glob pattern (or regular expression with MATCHER_REGEX)
+ * @param   flags       MATCHER_FOLD and/or MATCHER_REGEX
+ * @return  Pointer to new Matcher structure (must be deleted) or NULL if the
+ * regular expression is invalid.
+ **/
+Matcher *matcher_create(const char *pattern, int flags) {
+    Matcher *m = calloc(1, sizeof(Matcher));
+    m->fold = flags & MATCHER_FOLD;
+
+    if(flags & MATCHER_REGEX){
+        // Like find, the expression must match the whole path
+        size_t size = strlen(pattern) + 5;
+        char  *anchored = malloc(size);
+        snprintf(anchored, size, "^(%s)$", pattern);
+
+        int cflags = REG_EXTENDED | REG_NOSUB | (m->fold ? REG_ICASE : 0);
+        int status = regcomp(&m->regex, anchored, cflags);
+        free(anchored);
+
+        if(status != 0){
+            char message[BUFSIZ];
+            regerror(status, &m->regex, message, sizeof(message));
+            fprintf(stderr, "findit: invalid regex '%s': %s\n", pattern, message);
+            free(m);
+            return NULL;
+        }
+        m->kind = MATCH_REGEX;
+        return m;
+    }
+
+    m->pattern = strdup(pattern);
+    if(m->fold){
+        for(char *c = m->pattern; *c; c++) *c = fold(*c);
+    }
+
+    // Split pattern into leading stars, middle, and trailing stars
+    const char *begin = m->pattern;
+    const char *end   = begin + strlen(begin);
+    while(*begin == '*') begin++;
+
+    const char *middle_end = end;
+    while(middle_end > begin && middle_end[-1] == '*'){
+        // A star preceded by an odd number of backslashes is escaped
+        size_t slashes = 0;
+        for(const char *c = middle_end - 1; c > begin && c[-1] == '\\'; c--) slashes++;
+        if(slashes % 2) break;
+        middle_end--;
+    }
+
+    // Collect unescaped literal text of the middle; remember the longest
+    // literal run as a required substring in case the middle has wildcards
+    m->literal = malloc(end - begin + 1);
+    char  *run = malloc(end - begin + 1);
+    size_t nrun = 0;
+    bool   plain = true;
+
+    for(const char *c = begin; c < middle_end; c++){
+        if(glob_special(*c) && !(*c == '\\' && c + 1 < middle_end)){
+            plain = false;
+            nrun  = 0;
+            if(*c == '['){
+                // Skip bracket expression (it stands for one character)
+                const char *r = c + 1;
+                if(*r == '!' || *r == '^') r++;
+                if(*r == ']') r++;
+                while(r < middle_end && *r != ']'){
+                    int (*test)(int);
+                    const char *after = glob_class(r, &test);
+                    if(after && after <= middle_end){
+                        r = after;
+                        continue;
+                    }
+                    if(*r == '\\' && r + 1 < middle_end) r++;
+                    r++;
+                }
+                if(r < middle_end) c = r;
+            }
+            continue;
+        }
+        if(*c == '\\') c++;
+
+        run[nrun++] = *c;
+        if(plain){
+            m->literal[m->length++] = *c;
+        }
+        else if(nrun > m->length){
+            memcpy(m->literal, run, nrun);
+            m->length = nrun;
+        }
+    }
+    free(run);
+
+    if(plain){
+        bool lead  = begin > m->pattern;
+        bool trail = middle_end < end;
+        m->kind = lead ? (trail ? MATCH_CONTAINS : MATCH_SUFFIX)
+                       : (trail ? MATCH_PREFIX   : MATCH_LITERAL);
+    }
+    else{
+        m->kind = MATCH_GLOB;
+    }
+
+    return m;
+}
+
+/**
+ * Match string with compiled matcher.
+ * @param   m           Pointer to Matcher structure
+ * @param   s           String to match (must be NUL-terminated for regular
+ * expressions)
+ * @param   n           Length of string
+ * @return  true if string matches.
+ **/
+bool    matcher_match(const Matcher *m, const char *s, size_t n) {
+    switch(m->kind){
+        case MATCH_LITERAL:
+            return n == m->length && match_equal(s, m->literal, n, m->fold);
+        case MATCH_PREFIX:
+            return n >= m->length && match_equal(s, m->literal, m->length, m->fold);
+        case MATCH_SUFFIX:
+            return n >= m->length && match_equal(s + n - m->length, m->literal, m->length, m->fold);
+        case MATCH_CONTAINS:
+            return match_find(s, n, m->literal, m->length, m->fold);
+        case MATCH_GLOB:
+            return match_find(s, n, m->literal, m->length, m->fold) &&
+                   glob_match(m->pattern, s, n, m->fold);
+        case MATCH_REGEX:
+            return regexec(&m->regex, s, 0, NULL, 0) == 0;
+    }
+
+    return false;
+}
+
+/**
+ * Deallocate matcher.
+ * @param   m           Pointer to Matcher structure
+ **/
+void    matcher_delete(Matcher *m) {
+    if(!m) return;
+
+    if(m->kind == MATCH_REGEX) regfree(&m->regex);
+    free(m->literal);
+    free(m->pattern);
+    free(m);
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
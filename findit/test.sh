@@ -0,0 +1,40 @@
+#!/bin/sh
+# test.sh: Check findit name patterns against expected matches
+#
+# Usage: ./test.sh [FINDIT]   (default ./findit)
+
+FINDIT=${1:-./findit}
+ROOT=$(mktemp -d)
+trap 'rm -rf "$ROOT"' EXIT
+
+touch "$ROOT/1abc" "$ROOT/9x" "$ROOT/abc" "$ROOT/Zed" "$ROOT/a]b" "$ROOT/x:y"
+
+failures=0
+
+# check OPTION PATTERN EXPECTED: names matched (sorted, space-separated)
+check() {
+    actual=$(cd "$ROOT" && "$FINDIT" . -mindepth 1 "$1" "$2" | sed 's|^\./||' | sort | tr '\n' ' ' | sed 's/ $//')
+    if [ "$actual" != "$3" ]; then
+        echo "FAIL: $1 '$2': expected '$3', got '$actual'"
+        failures=$((failures + 1))
+    fi
+}
+
+check -name  'abc'                      'abc'
+check -name  '*c'                       '1abc abc'
+check -name  '[!a-z]*'                  '1abc 9x Zed'
+check -name  'a]b'                      'a]b'
+check -name  '[[:digit:]]*'             '1abc 9x'
+check -name  '[![:digit:]]*'            'Zed a]b abc x:y'
+check -name  '*[[:digit:]x]'            '9x'
+check -name  '[[:upper:]]*'             'Zed'
+check -name  '[[:alpha:]]b[[:alpha:]]'  'abc'
+check -name  '*[[:punct:]]*'            'a]b x:y'
+check -iname '[[:upper:]]*'             'Zed a]b abc x:y'
+check -iname 'z[[:lower:]]d'            'Zed'
+
+if [ "$failures" -ne 0 ]; then
+    echo "$failures test(s) failed"
+    exit 1
+fi
+echo "All tests passed"
@@ -0,0 +1,259 @@
+/* uring.c: Batched lstat through io_uring */
+
+#define _GNU_SOURCE  // struct statx
+
+#include "findit.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+/* Ring Structure */
+
+struct Ring {
+    int                  fd;            // io_uring file descriptor
+    unsigned             depth;         // Maximum requests in flight
+
+    unsigned            *sq_head;       // Submission queue head (kernel)
+    unsigned            *sq_tail;       // Submission queue tail (us)
+    unsigned            *sq_mask;       // Submission queue index mask
+    unsigned            *sq_array;      // Submission queue index array
+    struct io_uring_sqe *sqes;          // Submission queue entries
+
+    unsigned            *cq_head;       // Completion queue head (us)
+    unsigned            *cq_tail;       // Completion queue tail (kernel)
+    unsigned            *cq_mask;       // Completion queue index mask
+    struct io_uring_cqe *cqes;          // Completion queue entries
+
+    void                *sq_ring;       // Mapped submission ring
+    size_t               sq_size;       // Size of submission ring mapping
+    void                *cq_ring;       // Mapped completion ring
+    size_t               cq_size;       // Size of completion ring mapping
+    size_t               sqes_size;     // Size of submission entries mapping
+
+    struct statx        *results;       // Result buffers, one per request
+    size_t               capacity;      // Number of result buffers
+    bool                 broken;        // Whether submission failed for good
+    bool                 stranded;      // Whether requests were left in
+                                        // flight (results are never freed)
+};
+
+/* Ring Functions */
+
+/**
+ * Set up an io_uring instance.
+ * @param   depth       Maximum number of requests in flight
+ * @return  Pointer to new Ring structure (must be deleted) or NULL if
+ * io_uring is not available.
+ **/
+Ring *  ring_create(unsigned depth) {
+    struct io_uring_params params = {0};
+
+    int fd = syscall(__NR_io_uring_setup, depth, &params);
+    if(fd < 0) return NULL;
+
+    Ring *ring  = calloc(1, sizeof(Ring));
+    ring->fd    = fd;
+    ring->depth = params.sq_entries;
+
+    ring->sq_size   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size   = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED) goto failure;
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        ring->cq_ring = ring->sq_ring;
+    }
+    else{
+        ring->cq_ring = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ring == MAP_FAILED) goto failure;
+    }
+
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED) goto failure;
+
+    ring->sq_head  = (unsigned *)((char *)ring->sq_ring + params.sq_off.head);
+    ring->sq_tail  = (unsigned *)((char *)ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask  = (unsigned *)((char *)ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ring + params.sq_off.array);
+    ring->cq_head  = (unsigned *)((char *)ring->cq_ring + params.cq_off.head);
+    ring->cq_tail  = (unsigned *)((char *)ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask  = (unsigned *)((char *)ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *)((char *)ring->cq_ring + params.cq_off.cqes);
+
+    return ring;
+
+failure:
+    if(ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring){
+        munmap(ring->cq_ring, ring->cq_size);
+    }
+    if(ring->sq_ring && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_size);
+    close(fd);
+    free(ring);
+    return NULL;
+}
+
+/**
+ * Tear down io_uring instance.
+ * @param   ring        Pointer to Ring structure
+ **/
+void    ring_delete(Ring *ring) {
+    if(!ring) return;
+
+    munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_size);
+    munmap(ring->sq_ring, ring->sq_size);
+    close(ring->fd);
+    if(!ring->stranded) free(ring->results);
+    free(ring);
+}
+
+/**
+ * Convert statx result to the stat structure filters expect.
+ * @param   sx          Pointer to statx structure
+ * @param   st          Pointer to stat structure to fill
+ **/
+static void ring_convert(const struct statx *sx, struct stat *st) {
+    *st = (struct stat){
+        .st_dev     = makedev(sx->stx_dev_major, sx->stx_dev_minor),
+        .st_ino     = sx->stx_ino,
+        .st_mode    = sx->stx_mode,
+        .st_nlink   = sx->stx_nlink,
+        .st_uid     = sx->stx_uid,
+        .st_gid     = sx->stx_gid,
+        .st_rdev    = makedev(sx->stx_rdev_major, sx->stx_rdev_minor),
+        .st_size    = sx->stx_size,
+        .st_blksize = sx->stx_blksize,
+        .st_blocks  = sx->stx_blocks,
+    };
+    st->st_atim = (struct timespec){sx->stx_atime.tv_sec, sx->stx_atime.tv_nsec};
+    st->st_mtim = (struct timespec){sx->stx_mtime.tv_sec, sx->stx_mtime.tv_nsec};
+    st->st_ctim = (struct timespec){sx->stx_ctime.tv_sec, sx->stx_ctime.tv_nsec};
+}
+
+/**
+ * Take completed requests from the ring, caching the stat of each entry
+ * whose request succeeded.
+ * @param   ring        Pointer to Ring structure
+ * @param   entries     Array of pointers to Entry structures
+ * @return  Number of requests completed.
+ **/
+static size_t ring_reap(Ring *ring, Entry **entries) {
+    unsigned head = *ring->cq_head;
+    unsigned end  = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    size_t   n    = 0;
+
+    for(; head != end; head++, n++){
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        Entry *entry = entries[cqe->user_data];
+
+        if(cqe->res == 0){
+            ring_convert(&ring->results[cqe->user_data], &entry->st);
+            entry->statted = true;
+        }
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+/**
+ * Wait for the requests taken by the kernel to complete.
+ * @param   ring        Pointer to Ring structure
+ * @param   entries     Array of pointers to Entry structures
+ * @param   taken       Number of requests taken by the kernel
+ * @param   completed   Number of those already completed
+ * @return  false if waiting failed with requests still in flight (the ring
+ * is then stranded, and its result buffers are never freed).
+ **/
+static bool ring_drain(Ring *ring, Entry **entries, size_t taken, size_t completed) {
+    while((completed += ring_reap(ring, entries)) < taken){
+        if(syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR){
+            ring->stranded = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Fetch lstat information for a batch of entries, keeping up to the ring's
+ * depth of statx requests in flight. Entries whose request fails are left
+ * without a cached stat, so entry_stat retries them synchronously.
+ * @param   ring        Pointer to Ring structure
+ * @param   entries     Array of pointers to Entry structures
+ * @param   n           Number of entries
+ * @return  false if requests were left in flight: the kernel may still read
+ * the names of entries, which must then be neither freed nor reused.
+ **/
+bool    ring_stat(Ring *ring, Entry **entries, size_t n) {
+    if(ring->broken) return true;
+
+    if(n > ring->capacity){
+        free(ring->results);
+        ring->results  = malloc(n * sizeof(struct statx));
+        ring->capacity = n;
+    }
+
+    size_t submitted = 0;
+    size_t completed = 0;
+
+    while(completed < n){
+        // Queue as many requests as there is room for in flight
+        unsigned tail = *ring->sq_tail;
+        unsigned mask = *ring->sq_mask;
+
+        while(submitted < n && submitted - completed < ring->depth){
+            Entry *entry = entries[submitted];
+            struct io_uring_sqe *sqe = &ring->sqes[tail & mask];
+
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode      = IORING_OP_STATX;
+            sqe->fd          = entry->dirfd;
+            sqe->addr        = (unsigned long)entry->name;
+            sqe->len         = STATX_BASIC_STATS;
+            sqe->off         = (unsigned long)&ring->results[submitted];
+            sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+            sqe->user_data   = submitted;
+
+            ring->sq_array[tail & mask] = tail & mask;
+            tail++;
+            submitted++;
+        }
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+        // Submit whatever the kernel has not consumed yet and wait for at
+        // least one completion
+        unsigned queued = tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if(syscall(__NR_io_uring_enter, ring->fd, queued, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0){
+            if(errno == EINTR) continue;
+
+            // Never use this ring again (entries fall back to entry_stat),
+            // but wait for the requests the kernel took: they still read
+            // entry names and write result buffers
+            ring->broken = true;
+            return ring_drain(ring, entries, submitted - (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)), completed);
+        }
+
+        completed += ring_reap(ring, entries);
+    }
+    return true;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
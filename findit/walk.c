@@ -0,0 +1,624 @@
+/* walk.c: Batched, parallel work-stealing directory walker */
+
+#define _GNU_SOURCE  // scandirat
+
+#include "findit.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+/* Constants */
+
+#define DEQUE_CAPACITY  64          // Initial capacity of each worker deque
+#define IDLE_NANOSECONDS 1000000    // Upper bound on idle wait before retrying
+#define BATCH_SIZE      128         // Directory entries examined per batch
+#define RING_DEPTH      64          // statx requests in flight per worker
+
+/* Deque Structure */
+
+typedef struct {
+    pthread_mutex_t lock;           // Protects all fields below
+    Path          **tasks;          // Ring buffer of directory paths
+    size_t          capacity;       // Size of ring buffer
+    size_t          head;           // Index of oldest task (steal end)
+    size_t          size;           // Number of tasks in ring buffer
+} Deque;
+
+/* Batch Structure */
+
+typedef struct {
+    Entry           entries[BATCH_SIZE];    // Entries read from directory
+    size_t          offsets[BATCH_SIZE];    // Offset of each path in pool
+    size_t          resume[BATCH_SIZE];     // Where to resume each program
+    size_t          size;                   // Number of entries
+    char           *pool;                   // Storage for entry paths
+    size_t          used;                   // Bytes used in pool
+    size_t          capacity;               // Size of pool
+    bool            stranded;               // Whether the kernel may still
+                                            // read entries (never reused
+                                            // or freed)
+} Batch;
+
+/* Reader Structure */
+
+typedef struct {
+    DIR            *dir;            // Directory stream (unsorted walks)
+    struct dirent **sorted;         // Sorted directory entries (sorted walks)
+    int             nsorted;        // Number of sorted entries
+    int             next;           // Index of next sorted entry
+} Reader;
+
+/* Walker Structure */
+
+typedef struct Walker Walker;
+
+typedef struct {
+    Walker         *walker;         // Shared walker state
+    size_t          id;             // Worker index
+    Deque           deque;          // Worker's own deque of directories
+    List            files;          // Matches (and directory Paths) of worker
+    unsigned int    seed;           // Seed for picking steal victims
+    Ring           *ring;           // io_uring for batched lstat (or NULL)
+    Output          output;         // Buffered output of matches (printing)
+} Worker;
+
+struct Walker {
+    Worker         *workers;        // Array of workers
+    size_t          jobs;           // Number of workers
+    Program        *program;        // Filter program
+    bool            sorted;         // Visit directory entries in sorted order
+    bool            collect;        // Collect matches instead of printing
+    size_t          mindepth;       // Shallowest depth to evaluate program at
+    size_t          maxdepth;       // Deepest depth to visit
+    bool            xdev;           // Stay on root's file system
+    dev_t           device;         // Root's file system (for xdev)
+    atomic_size_t   pending;        // Directories queued or being walked
+    atomic_size_t   idle;           // Workers waiting for work
+    pthread_mutex_t lock;           // Protects wakeup condition
+    pthread_cond_t  wakeup;         // Signaled when new work is pushed
+    pthread_mutex_t output;         // Serializes flushes of worker outputs
+};
+
+/* Deque Functions */
+
+/**
+ * Push directory path onto bottom (owner end) of deque.
+ * @param   d           Pointer to Deque structure
+ * @param   path        Directory path
+ **/
+static void deque_push(Deque *d, Path *path) {
+    pthread_mutex_lock(&d->lock);
+
+    if(d->size == d->capacity){
+        size_t capacity = d->capacity ? 2*d->capacity : DEQUE_CAPACITY;
+        Path **tasks = malloc(capacity * sizeof(Path *));
+        for(size_t i = 0; i < d->size; i++){
+            tasks[i] = d->tasks[(d->head + i) % d->capacity];
+        }
+        free(d->tasks);
+        d->tasks    = tasks;
+        d->capacity = capacity;
+        d->head     = 0;
+    }
+
+    d->tasks[(d->head + d->size) % d->capacity] = path;
+    d->size++;
+
+    pthread_mutex_unlock(&d->lock);
+}
+
+/**
+ * Pop most recently pushed directory from bottom of deque (depth-first, so
+ * the owner stays within the subtree it just opened).
+ * @param   d           Pointer to Deque structure
+ * @return  Directory path or NULL if deque is empty.
+ **/
+static Path *deque_pop(Deque *d) {
+    Path *path = NULL;
+
+    pthread_mutex_lock(&d->lock);
+    if(d->size){
+        d->size--;
+        path = d->tasks[(d->head + d->size) % d->capacity];
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    return path;
+}
+
+/**
+ * Steal oldest directory from top of deque (breadth-first, so thieves take
+ * the shallowest and typically largest remaining subtrees).
+ * @param   d           Pointer to Deque structure
+ * @return  Directory path or NULL if deque is empty.
+ **/
+static Path *deque_steal(Deque *d) {
+    Path *path = NULL;
+
+    if(pthread_mutex_trylock(&d->lock) != 0) return NULL;
+    if(d->size){
+        path = d->tasks[d->head];
+        d->head = (d->head + 1) % d->capacity;
+        d->size--;
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    return path;
+}
+
+/* Worker Functions */
+
+/**
+ * Queue directory on worker's deque and wake an idle worker if any.
+ * @param   w           Pointer to Worker structure
+ * @param   path        Directory path
+ **/
+static void worker_push(Worker *w, Path *path) {
+    Walker *walker = w->walker;
+
+    atomic_fetch_add(&walker->pending, 1);
+    deque_push(&w->deque, path);
+
+    if(atomic_load(&walker->idle)){
+        pthread_mutex_lock(&walker->lock);
+        pthread_cond_signal(&walker->wakeup);
+        pthread_mutex_unlock(&walker->lock);
+    }
+}
+
+/**
+ * Output or collect path of matching entry.
+ * @param   w           Pointer to Worker structure
+ * @param   path        Path string
+ * @param   p           Path structure to collect (when collecting)
+ **/
+static void worker_output(Worker *w, const char *path, Path *p) {
+    if(w->walker->collect){
+        list_append(&w->files, (Data){.path = p});
+    }
+    else{
+        // Workers buffer whole records and flush under a shared lock, so
+        // lines never interleave
+        output_record(&w->output, path, strlen(path));
+    }
+}
+
+/* Reader Functions */
+
+/**
+ * Start reading directory, taking ownership of its file descriptor.
+ * @param   r           Pointer to Reader structure
+ * @param   fd          Directory file descriptor
+ * @param   sorted      Whether to read entries in sorted order
+ * @return  true on success (otherwise fd is closed).
+ **/
+static bool reader_open(Reader *r, int fd, bool sorted) {
+    *r = (Reader){0};
+
+    if(sorted){
+        // Sorted walks read one directory at a time with scandirat, so
+        // memory is bounded by the largest directory rather than the tree
+        if((r->nsorted = scandirat(fd, ".", &r->sorted, NULL, alphasort)) < 0){
+            perror("scandir");
+            close(fd);
+            return false;
+        }
+        return true;
+    }
+
+    if(!(r->dir = fdopendir(fd))){
+        perror("opendir");
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read next directory entry.
+ * @param   r           Pointer to Reader structure
+ * @return  Pointer to dirent structure or NULL at end of directory.
+ **/
+static struct dirent *reader_next(Reader *r) {
+    if(r->dir) return readdir(r->dir);
+    return r->next < r->nsorted ? r->sorted[r->next++] : NULL;
+}
+
+/**
+ * Stop reading directory and close its file descriptor.
+ * @param   r           Pointer to Reader structure
+ * @param   fd          Directory file descriptor
+ **/
+static void reader_close(Reader *r, int fd) {
+    if(r->dir){
+        closedir(r->dir);
+        return;
+    }
+
+    for(int i = 0; i < r->nsorted; i++){
+        free(r->sorted[i]);
+    }
+    free(r->sorted);
+    close(fd);
+}
+
+/* Batch Functions */
+
+/**
+ * Fill batch with up to BATCH_SIZE entries of directory.
+ * @param   b           Pointer to Batch structure
+ * @param   r           Pointer to Reader structure
+ * @param   fd          Directory file descriptor
+ * @param   root        Directory path
+ * @return  Number of entries read (0 at end of directory).
+ **/
+static size_t batch_fill(Batch *b, Reader *r, int fd, const char *root) {
+    size_t rootlen = strlen(root);
+    struct dirent *e;
+
+    b->size = 0;
+    b->used = 0;
+
+    while(b->size < BATCH_SIZE && (e = reader_next(r)) != NULL){
+        if(strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0){
+            continue;
+        }
+
+        // Paths are stored back to back; pointers are set once the pool
+        // stops growing
+        size_t length = rootlen + 1 + strlen(e->d_name) + 1;
+        if(b->used + length > b->capacity){
+            b->capacity = 2*(b->used + length);
+            b->pool = realloc(b->pool, b->capacity);
+        }
+        snprintf(b->pool + b->used, length, "%s/%s", root, e->d_name);
+
+        b->offsets[b->size] = b->used;
+        b->entries[b->size] = (Entry){
+            .dirfd = fd,
+            .type  = e->d_type,
+        };
+        b->used += length;
+        b->size++;
+    }
+
+    for(size_t i = 0; i < b->size; i++){
+        Entry *entry = &b->entries[i];
+        entry->path = b->pool + b->offsets[i];
+        entry->name = entry->path + rootlen + 1;
+        entry->base = entry->name;
+    }
+
+    return b->size;
+}
+
+static void walk_directory(Worker *w, int fd, const char *root, const Path *dir, size_t depth);
+
+/**
+ * Determine whether walker should descend into entry: it must be a directory
+ * that was not pruned, lies above the maximum depth and, with xdev, is on the
+ * root's file system.
+ * @param   walker      Pointer to Walker structure
+ * @param   entry       Pointer to Entry structure
+ * @param   depth       Depth of entry
+ * @return  true if entry's contents should be walked.
+ **/
+static bool walker_descend(Walker *walker, Entry *entry, size_t depth) {
+    if(entry->prune || depth >= walker->maxdepth || !entry_is_directory(entry)){
+        return false;
+    }
+    if(!walker->xdev) return true;
+
+    struct stat *st = entry_stat(entry);
+    return st && st->st_dev == walker->device;
+}
+
+/**
+ * Evaluate program on each entry of batch, then output matches and descend
+ * into (or queue) subdirectories in directory order. With io_uring, a first
+ * pass runs every program up to the first predicate that needs lstat, all of
+ * those lstats are fetched together, and a second pass finishes the programs.
+ * @param   w           Pointer to Worker structure
+ * @param   b           Pointer to Batch structure
+ * @param   fd          Directory file descriptor
+ * @param   dir         Directory Path structure (may be NULL for serial walks
+ * that print)
+ * @param   depth       Depth of entries in batch
+ **/
+static void batch_run(Worker *w, Batch *b, int fd, const Path *dir, size_t depth) {
+    Walker  *walker  = w->walker;
+    Program *program = walker->program;
+
+    // Above the minimum depth no tests are applied at all
+    bool evaluate = depth >= walker->mindepth;
+
+    for(size_t i = 0; i < b->size; i++){
+        b->resume[i] = evaluate ? program->start : PROGRAM_REJECT;
+    }
+
+    if(w->ring && evaluate){
+        Entry *pending[BATCH_SIZE];
+        size_t npending = 0;
+
+        for(size_t i = 0; i < b->size; i++){
+            Entry *entry = &b->entries[i];
+            b->resume[i] = program_resume(program, entry, program->start, true);
+
+            // Unknown types also need lstat to decide whether to descend
+            if(b->resume[i] < program->size || entry->type == DT_UNKNOWN){
+                pending[npending++] = entry;
+            }
+        }
+
+        if(npending && !ring_stat(w->ring, pending, npending)) b->stranded = true;
+    }
+
+    for(size_t i = 0; i < b->size; i++){
+        Entry *entry = &b->entries[i];
+
+        bool accept    = program_resume(program, entry, b->resume[i], false) == PROGRAM_ACCEPT;
+        bool directory = walker_descend(walker, entry, depth);
+
+        // Collected matches and queued directories are stored as parent plus
+        // name in the worker's arena (one Path serves both)
+        Path *path = NULL;
+        if((accept && walker->collect) || (directory && (walker->jobs > 1 || walker->collect))){
+            path = path_create(&w->files.arena, dir, entry->base);
+        }
+
+        if(accept) worker_output(w, entry->path, path);
+
+        if(!directory) continue;
+
+        if(walker->jobs > 1){
+            worker_push(w, path);
+            continue;
+        }
+
+        // Serial walks descend immediately, keeping this directory open so
+        // the subdirectory is opened relative to it
+        int child = openat(fd, entry->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(child < 0){
+            perror("opendir");
+            continue;
+        }
+        walk_directory(w, child, entry->path, path, depth);
+    }
+}
+
+/* Walk Functions */
+
+/**
+ * Walk one directory in batches, examining entries relative to the open
+ * directory rather than by full path. The directory itself was already
+ * emitted by whoever discovered it.
+ * @param   w           Pointer to Worker structure
+ * @param   fd          Directory file descriptor (ownership is transferred)
+ * @param   root        Directory path
+ * @param   dir         Directory Path structure (may be NULL for serial walks
+ * that print)
+ * @param   depth       Depth of directory (0 for root)
+ **/
+static void walk_directory(Worker *w, int fd, const char *root, const Path *dir, size_t depth) {
+    Reader reader;
+    if(!reader_open(&reader, fd, w->walker->sorted)) return;
+
+    Batch *batch = calloc(1, sizeof(Batch));
+    while(batch_fill(batch, &reader, fd, root)){
+        batch_run(w, batch, fd, dir, depth + 1);
+
+        // A batch the kernel may still read is abandoned, not reused
+        if(batch->stranded) batch = calloc(1, sizeof(Batch));
+    }
+
+    free(batch->pool);
+    free(batch);
+    reader_close(&reader, fd);
+}
+
+/**
+ * Walk directory taken from a deque.
+ * @param   w           Pointer to Worker structure
+ * @param   dir         Directory Path structure
+ **/
+static void worker_walk(Worker *w, const Path *dir) {
+    char root[BUFSIZ];
+    if(!path_format(dir, root, BUFSIZ)){
+        fprintf(stderr, "findit: path too long\n");
+        return;
+    }
+
+    int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0){
+        perror("opendir");
+    }
+    else{
+        walk_directory(w, fd, root, dir, dir->depth);
+    }
+}
+
+/**
+ * Find work for an idle worker by stealing from the other workers, starting
+ * at a random victim.
+ * @param   w           Pointer to Worker structure
+ * @return  Directory path or NULL if nothing could be stolen.
+ **/
+static Path *worker_steal(Worker *w) {
+    Walker *walker = w->walker;
+    size_t  start  = rand_r(&w->seed) % walker->jobs;
+
+    for(size_t i = 0; i < walker->jobs; i++){
+        Worker *victim = &walker->workers[(start + i) % walker->jobs];
+        if(victim == w) continue;
+
+        Path *path = deque_steal(&victim->deque);
+        if(path) return path;
+    }
+
+    return NULL;
+}
+
+/**
+ * Worker thread: walk own directories first, then steal from others until
+ * no directories remain anywhere.
+ * @param   arg         Pointer to Worker structure
+ * @return  NULL
+ **/
+static void *worker_thread(void *arg) {
+    Worker *w      = arg;
+    Walker *walker = w->walker;
+
+    while(true){
+        Path *path = deque_pop(&w->deque);
+        if(!path) path = worker_steal(w);
+
+        if(path){
+            worker_walk(w, path);
+            if(atomic_fetch_sub(&walker->pending, 1) == 1){
+                // Last directory finished: release everyone waiting
+                pthread_mutex_lock(&walker->lock);
+                pthread_cond_broadcast(&walker->wakeup);
+                pthread_mutex_unlock(&walker->lock);
+            }
+            continue;
+        }
+
+        if(atomic_load(&walker->pending) == 0) break;
+
+        // Nothing to steal yet: wait until new work is pushed (bounded, since
+        // a push may race with us going idle)
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += IDLE_NANOSECONDS;
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&walker->lock);
+        atomic_fetch_add(&walker->idle, 1);
+        if(atomic_load(&walker->pending) != 0){
+            pthread_cond_timedwait(&walker->wakeup, &walker->lock, &deadline);
+        }
+        atomic_fetch_sub(&walker->idle, 1);
+        pthread_mutex_unlock(&walker->lock);
+    }
+
+    return NULL;
+}
+
+/* Walker Functions */
+
+/**
+ * Walk specified root, filtering each file system entity as it is discovered.
+ *
+ * With one job, the walk recurses depth first. With more, each worker owns a
+ * deque of directories: it pops from the bottom of its own deque and, when
+ * empty, steals from the top of another worker's deque.
+ *
+ * Matches are printed immediately unless a files list is given, in which case
+ * they are collected there (in no particular order for parallel walks; see
+ * list_sort).
+ *
+ * @param   root        Directory to walk
+ * @param   settings    Pointer to Settings structure
+ * @param   files       List of matching files (NULL to print instead)
+ **/
+void    find_files(const char *root, Settings *settings, List *files) {
+    size_t jobs = settings->jobs;
+    Walker walker = {
+        .workers  = calloc(jobs, sizeof(Worker)),
+        .jobs     = jobs,
+        .program  = settings->program,
+        .sorted   = settings->sorted,
+        .collect  = files != NULL,
+        .mindepth = settings->mindepth,
+        .maxdepth = settings->maxdepth,
+        .xdev     = settings->xdev,
+    };
+    pthread_mutex_init(&walker.lock, NULL);
+    pthread_cond_init(&walker.wakeup, NULL);
+    pthread_mutex_init(&walker.output, NULL);
+
+    for(size_t i = 0; i < jobs; i++){
+        walker.workers[i].walker = &walker;
+        walker.workers[i].id     = i;
+        walker.workers[i].seed   = i + 1;
+        pthread_mutex_init(&walker.workers[i].deque.lock, NULL);
+
+        if(!walker.collect){
+            output_init(&walker.workers[i].output, STDOUT_FILENO, 0, settings->delimiter,
+                        jobs > 1 ? &walker.output : NULL);
+        }
+
+        // Without io_uring, lstat is simply done synchronously on demand
+        if(settings->uring){
+            walker.workers[i].ring = ring_create(RING_DEPTH);
+        }
+    }
+
+    Entry entry;
+    char  buffer[BUFSIZ];
+    Path *top = path_create(&walker.workers[0].files.arena, NULL, root);
+
+    entry_init(&entry, root, buffer);
+    if(walker.mindepth == 0 && program_run(walker.program, &entry)){
+        worker_output(&walker.workers[0], root, top);
+    }
+
+    // The root's own device is the one -xdev stays on
+    struct stat st;
+    if(walker.xdev && stat(root, &st) == 0){
+        walker.device = st.st_dev;
+    }
+
+    // Root's contents may be cut off by -prune or -maxdepth 0
+    bool descend = !entry.prune && walker.maxdepth > 0;
+
+    if(descend && jobs == 1){
+        int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(fd < 0){
+            perror("opendir");
+        }
+        else{
+            walk_directory(&walker.workers[0], fd, root, top, 0);
+        }
+    }
+    else if(descend){
+        worker_push(&walker.workers[0], top);
+
+        pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+        for(size_t i = 1; i < jobs; i++){
+            pthread_create(&threads[i], NULL, worker_thread, &walker.workers[i]);
+        }
+        worker_thread(&walker.workers[0]);
+        for(size_t i = 1; i < jobs; i++){
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+    }
+
+    for(size_t i = 0; i < jobs; i++){
+        // Queued directories may be parents of any worker's matches, so
+        // every arena lives as long as the collected list
+        if(files) list_concat(files, &walker.workers[i].files);
+        else list_delete(&walker.workers[i].files);
+        if(!walker.collect) output_delete(&walker.workers[i].output);
+        ring_delete(walker.workers[i].ring);
+        free(walker.workers[i].deque.tasks);
+        pthread_mutex_destroy(&walker.workers[i].deque.lock);
+    }
+
+    pthread_mutex_destroy(&walker.output);
+    pthread_cond_destroy(&walker.wakeup);
+    pthread_mutex_destroy(&walker.lock);
+    free(walker.workers);
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -3,40 +3,178 @@
 #include "findit.h"
 
 #include <stdlib.h>
+#include <string.h>
+
+/* Constants */
+
+#define ARENA_CHUNK     (1 << 20)           // Default chunk size
+#define ARENA_ALIGN     sizeof(void *)      // Alignment of allocations
+
+/* Chunk Structure */
+
+struct Chunk {
+    Chunk  *next;       // Next (older) chunk
+    void   *data[];     // Start of storage (pointer aligned)
+};
+
+/* Arena Functions */
+
+/**
+ * Allocate memory from arena by bumping a pointer, grabbing a new chunk when
+ * the current one is full. Memory is only released by arena_delete.
+ * @param   a           Pointer to Arena structure
+ * @param   size        Number of bytes
+ * @return  Pointer to pointer-aligned, uninitialized memory.
+ **/
+void *  arena_alloc(Arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if((size_t)(a->end - a->next) < size){
+        size_t capacity = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        Chunk *chunk = malloc(sizeof(Chunk) + capacity);
+        if(!chunk){
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        chunk->next = a->chunks;
+        a->chunks   = chunk;
+        a->next     = (char *)chunk->data;
+        a->end      = a->next + capacity;
+    }
+
+    void *memory = a->next;
+    a->next += size;
+    return memory;
+}
+
+/**
+ * Move all chunks of other arena into specified arena (allocations in either
+ * stay valid until the combined arena is deleted).
+ * @param   a           Pointer to Arena structure
+ * @param   other       Pointer to Arena structure to empty into a
+ **/
+void    arena_concat(Arena *a, Arena *other) {
+    if(other->chunks == NULL) return;
+
+    Chunk *last = other->chunks;
+    while(last->next) last = last->next;
+
+    last->next = a->chunks;
+    a->chunks  = other->chunks;
+    if(a->next == NULL){
+        a->next = other->next;
+        a->end  = other->end;
+    }
+    *other = (Arena){0};
+}
+
+/**
+ * Release all memory allocated from arena at once.
+ * @param   a           Pointer to Arena structure
+ **/
+void    arena_delete(Arena *a) {
+    Chunk *chunk = a->chunks;
+
+    while(chunk){
+        Chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    *a = (Arena){0};
+}
+
+/* Path Functions */
+
+/**
+ * Allocate a new Path structure in arena. Only the last component is stored;
+ * the rest of the path is shared with the parent.
+ * @param   a           Pointer to Arena structure
+ * @param   parent      Pointer to parent Path structure (NULL for root)
+ * @param   name        Last component (or whole root path)
+ * @return  Pointer to new Path structure (released with the arena).
+ **/
+Path *  path_create(Arena *a, const Path *parent, const char *name) {
+    size_t length = strlen(name);
+    Path  *p = arena_alloc(a, sizeof(Path) + length + 1);
+
+    p->parent = parent;
+    p->depth  = parent ? parent->depth + 1 : 0;
+    p->length = parent ? parent->length + 1 + length : length;
+    memcpy(p->name, name, length + 1);
+    return p;
+}
+
+/**
+ * Write full path into buffer, from the last component backwards.
+ * @param   p           Pointer to Path structure
+ * @param   buffer      Buffer to write to
+ * @param   size        Size of buffer
+ * @return  true on success, false if path does not fit.
+ **/
+bool    path_format(const Path *p, char *buffer, size_t size) {
+    if(p->length >= size) return false;
+
+    char *end = buffer + p->length;
+    *end = 0;
+
+    for(; p; p = p->parent){
+        size_t length = strlen(p->name);
+        end -= length;
+        memcpy(end, p->name, length);
+        if(p->parent) *--end = '/';
+    }
+    return true;
+}
+
+/**
+ * Compare two paths component by component, so that sorting yields the same
+ * order as a depth-first walk that visits each directory's entries sorted by
+ * name (a directory comes right before its contents).
+ * @param   a           First path
+ * @param   b           Second path
+ * @return  Negative, zero, or positive like strcmp.
+ **/
+int     path_compare(const Path *a, const Path *b) {
+    // Bring deeper path up to the other's depth; an ancestor sorts first
+    int tie = 0;
+    while(a->depth > b->depth){
+        a   = a->parent;
+        tie = 1;
+    }
+    while(b->depth > a->depth){
+        b   = b->parent;
+        tie = -1;
+    }
+    if(a == b) return tie;
+
+    // Climb together until both share a parent, then order by those
+    // components
+    while(a->parent != b->parent){
+        a = a->parent;
+        b = b->parent;
+    }
+
+    int order = strcmp(a->name, b->name);
+    return order ? order : tie;
+}
 
 /* Node Functions */
 
 /**
- * Allocate a new Node structure.
+ * Allocate a new Node structure in arena.
+ * @param   a           Pointer to Arena structure
  * @param   data        Data value
  * @param   next        Pointer to next Node structure
- * @return  Pointer to new Node structure (must be deleted).
+ * @return  Pointer to new Node structure (released with the arena).
  **/
-Node *  node_create(Data data, Node *next) {
-    // Use calloc
-    Node *newNode = calloc(1, sizeof(Node));
+static Node *node_create(Arena *a, Data data, Node *next) {
+    Node *newNode = arena_alloc(a, sizeof(Node));
     newNode->data = data;
     newNode->next = next;
     
     return newNode;
 }
 
-/**
- * Deallocate Node structure.
- * @param   n           Pointer to Node structure
- * @param   release     Whether or not to free Data string
- * @param   recursive   Whether or not to recursively delete next Node structure
- **/
-void    node_delete(Node *n, bool release, bool recursive) {
-    // Handle base case, recursive case, and then release data and Node
-    if(n == NULL) return;
-    
-    if (recursive) node_delete(n->next, release, recursive);
-    
-    if(release && n->data.string != NULL) free(n->data.string);
-    free(n);
-}
-
 /* List Functions */
 
 /**
@@ -46,7 +184,7 @@ void    node_delete(Node *n, bool release, bool recursive) {
  **/
 void    list_append(List *l, Data data) {
     // Create new Node Structure and add to end of List
-    Node *newNode = node_create(data, NULL);
+    Node *newNode = node_create(&l->arena, data, NULL);
     
     if(l->head == NULL && l->tail == NULL){
         l->head = newNode;
@@ -59,65 +197,118 @@ void    list_append(List *l, Data data) {
 }
 
 /**
- * Filter list by applying the filter function to each Data string in List with
- * the given options:
- *
- *  - If filter function returns true, then keep current Node.
- *  - Otherwise, remove current Node from List and delete it.
- *
+ * Output each Data path in List to specified output.
  * @param   l           Pointer to List structure
- * @param   filter      Filter function to apply to each Data string
- * @param   options     Pointer to Options structure to use with filter function
- * @param   release     Whether or not to release data string when deleting Node
+ * @param   o           Pointer to Output structure
  **/
-void    list_filter(List *l, Filter filter, Options *options, bool release) {
-    // Iterate through List and apply filter function to each Data string
-    // to determine whether or not to keep the Node.
+void    list_output(List *l, Output *o) {
+    // Iterate though List and output each Data path as one record (one path
+    // per line, or NUL-terminated).
     Node *curr = l->head;
-    Node *prev = NULL;
-    Node *next;
-
-    bool check;
-    
-    while(curr != NULL){
-        next = curr->next;
+    char path[BUFSIZ];
         
-        check = filter(curr->data.string, options);
-
-        if(!check){
-            if(prev == NULL){
-                l->head = next;
-            }
-            else{
-                prev->next = next;
-            }
-
-            if(curr == l->tail){
-                l->tail = prev;
-            }
-             
-            node_delete(curr, release, false);
+    while(curr){
+        if(path_format(curr->data.path, path, BUFSIZ)){
+            output_record(o, path, curr->data.path->length);
         }
-        else prev = curr;
+        curr = curr->next;
+    }
+}
 
-        curr = next;
+/**
+ * Merge two sorted chains of Nodes into one sorted chain.
+ * @param   a           First sorted chain
+ * @param   b           Second sorted chain
+ * @param   compare     Comparison function for Data paths
+ * @return  Head of merged chain.
+ **/
+static Node *node_merge(Node *a, Node *b, int (*compare)(const Path *, const Path *)) {
+    Node  head = {0};
+    Node *tail = &head;
+
+    while(a && b){
+        if(compare(b->data.path, a->data.path) < 0){
+            tail->next = b;
+            b = b->next;
+        }
+        else{
+            tail->next = a;
+            a = a->next;
+        }
+        tail = tail->next;
     }
+
+    tail->next = a ? a : b;
+    return head.next;
 }
 
 /**
- * Output each Data string in List to specified stream.
+ * Sort List by Data path using a stable bottom-up merge sort (no recursion,
+ * so lists with millions of Nodes are safe).
  * @param   l           Pointer to List structure
- * @param   stream      File stream to output to
+ * @param   compare     Comparison function for Data paths
  **/
-void    list_output(List *l, FILE *stream) {
-    // Iterate though List and output each Data string to given stream
-    // (one string per line).
+void    list_sort(List *l, int (*compare)(const Path *, const Path *)) {
+    // Keep an array of sorted runs where runs[i] holds 2^i Nodes (or NULL),
+    // merging runs of equal size like a binary counter.
+    Node *runs[64] = {0};
     Node *curr = l->head;
-        
+
     while(curr){
-        fprintf(stream, "%s\n", curr->data.string);
-        curr = curr->next;
+        Node *next = curr->next;
+        curr->next = NULL;
+
+        size_t i = 0;
+        for(; runs[i]; i++){
+            curr = node_merge(runs[i], curr, compare);
+            runs[i] = NULL;
+        }
+        runs[i] = curr;
+        curr = next;
+    }
+
+    Node *sorted = NULL;
+    for(size_t i = 0; i < 64; i++){
+        if(runs[i]) sorted = node_merge(runs[i], sorted, compare);
     }
+
+    l->head = sorted;
+    l->tail = sorted;
+    while(l->tail && l->tail->next){
+        l->tail = l->tail->next;
+    }
+}
+
+/**
+ * Move all Nodes (and the arena holding them) from other List to end of
+ * specified List.
+ * @param   l           Pointer to List structure
+ * @param   other       Pointer to List structure to empty into l
+ **/
+void    list_concat(List *l, List *other) {
+    arena_concat(&l->arena, &other->arena);
+    if(other->head == NULL) return;
+
+    if(l->head == NULL){
+        l->head = other->head;
+    }
+    else{
+        l->tail->next = other->head;
+    }
+
+    l->tail = other->tail;
+    other->head = NULL;
+    other->tail = NULL;
+}
+
+/**
+ * Deallocate all Nodes and Paths of List at once.
+ * @param   l           Pointer to List structure
+ **/
+void    list_delete(List *l) {
+    arena_delete(&l->arena);
+    l->head = NULL;
+    l->tail = NULL;
 }
 
 /* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
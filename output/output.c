@@ -0,0 +1,149 @@
+/* output.c: Buffered Output Library */
+
+#include "output.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Internal Functions */
+
+/**
+ * Write all of the given vectors, retrying after short writes and signals.
+ * @param   o           Pointer to Output structure
+ * @param   iov         Array of iovec structures (modified)
+ * @param   n           Number of iovec structures
+ **/
+static void output_writev(Output *o, struct iovec *iov, int n) {
+    if(o->lock) pthread_mutex_lock(o->lock);
+
+    while(n > 0 && !o->failed){
+        ssize_t written = writev(o->fd, iov, n);
+        if(written < 0){
+            if(errno == EINTR) continue;
+            perror("write");
+            o->failed = true;
+            break;
+        }
+
+        // Skip what was written, possibly ending partway into a vector
+        while(n > 0 && (size_t)written >= iov->iov_len){
+            written -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if(n > 0){
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    if(o->lock) pthread_mutex_unlock(o->lock);
+}
+
+/**
+ * Append bytes (and optionally the record delimiter) to the buffer. When they
+ * do not fit, large data is written straight from the caller's memory
+ * together with the pending buffer in a single writev rather than copied.
+ * On a terminal, bytes that complete a record are written at once.
+ * @param   o           Pointer to Output structure
+ * @param   data        Bytes to append
+ * @param   n           Number of bytes
+ * @param   delimit     Whether to terminate bytes with the delimiter
+ **/
+static void output_append(Output *o, const void *data, size_t n, bool delimit) {
+    size_t total = n + delimit;
+
+    if(o->used + total > o->capacity){
+        if(total > o->capacity / 2){
+            struct iovec iov[] = {
+                {o->buffer, o->used},
+                {(void *)data, n},
+                {&o->delimiter, delimit},
+            };
+            output_writev(o, iov, 3);
+            o->used = 0;
+            return;
+        }
+        output_flush(o);
+    }
+
+    memcpy(o->buffer + o->used, data, n);
+    o->used += n;
+    if(delimit) o->buffer[o->used++] = o->delimiter;
+
+    if(o->interactive && (delimit || memchr(data, o->delimiter, n))){
+        output_flush(o);
+    }
+}
+
+/* Output Functions */
+
+/**
+ * Initialize Output structure. Output to a terminal is flushed at each
+ * delimiter, so only pipes and files are fully buffered.
+ * @param   o           Pointer to Output structure
+ * @param   fd          File descriptor to write to
+ * @param   capacity    Size of buffer (0 for OUTPUT_CAPACITY)
+ * @param   delimiter   Record terminator
+ * @param   lock        Lock serializing flushes of writers that share fd, so
+ * their records never interleave (NULL if there is only one writer)
+ **/
+void    output_init(Output *o, int fd, size_t capacity, char delimiter, pthread_mutex_t *lock) {
+    *o = (Output){
+        .fd          = fd,
+        .capacity    = capacity ? capacity : OUTPUT_CAPACITY,
+        .delimiter   = delimiter,
+        .lock        = lock,
+        .interactive = isatty(fd),
+    };
+    o->buffer = malloc(o->capacity);
+}
+
+/**
+ * Flush and deallocate Output buffer.
+ * @param   o           Pointer to Output structure
+ **/
+void    output_delete(Output *o) {
+    output_flush(o);
+    free(o->buffer);
+    o->buffer = NULL;
+}
+
+/**
+ * Write raw bytes.
+ * @param   o           Pointer to Output structure
+ * @param   data        Bytes to write
+ * @param   n           Number of bytes
+ **/
+void    output_write(Output *o, const void *data, size_t n) {
+    output_append(o, data, n, false);
+}
+
+/**
+ * Write record followed by the delimiter.
+ * @param   o           Pointer to Output structure
+ * @param   s           Record bytes
+ * @param   n           Number of bytes
+ **/
+void    output_record(Output *o, const char *s, size_t n) {
+    output_append(o, s, n, true);
+}
+
+/**
+ * Write all pending bytes.
+ * @param   o           Pointer to Output structure
+ **/
+void    output_flush(Output *o) {
+    if(o->used == 0) return;
+
+    struct iovec iov = {o->buffer, o->used};
+    output_writev(o, &iov, 1);
+    o->used = 0;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
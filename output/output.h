@@ -0,0 +1,35 @@
+/* output.h: Buffered Output Library */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Constants */
+
+#define OUTPUT_CAPACITY (1 << 17)   // Default buffer size in bytes
+
+/* Output Structure */
+
+typedef struct {
+    int              fd;        // File descriptor to write to
+    char            *buffer;    // Pending bytes (whole records only)
+    size_t           used;      // Number of pending bytes
+    size_t           capacity;  // Size of buffer
+    char             delimiter; // Record terminator ('\n', or '\0' for -print0)
+    pthread_mutex_t *lock;      // Lock shared by writers of fd (or NULL)
+    bool             failed;    // Whether a write failed
+    bool             interactive;   // Whether fd is a terminal (flushed at
+                                    // each delimiter, like line-buffered
+                                    // stdio)
+} Output;
+
+void    output_init(Output *o, int fd, size_t capacity, char delimiter, pthread_mutex_t *lock);
+void    output_delete(Output *o);
+
+void    output_write(Output *o, const void *data, size_t n);
+void    output_record(Output *o, const char *s, size_t n);
+void    output_flush(Output *o);
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,234 @@
+/* counter.c: Decimal counter stepped on its ASCII digits */
+
+#include "seqit.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Internal Functions */
+
+/**
+ * Position of digit in text of magnitude, skipping the decimal point.
+ * @param   c           Pointer to Counter structure
+ * @param   i           Index of digit (0 is the least significant)
+ * @return  Pointer to digit (before start if the magnitude is shorter).
+ **/
+static char *counter_digit(const Counter *c, size_t i) {
+    return c->end - 1 - i - (c->scale && i >= c->scale);
+}
+
+/**
+ * Add step to magnitude, propagating the carry through the ASCII digits
+ * (usually only the last digit changes).
+ * @param   c           Pointer to Counter structure
+ **/
+static void counter_add(Counter *c) {
+    unsigned carry = 0;
+
+    for(size_t i = 0; i < c->nstep || carry; i++){
+        char *d = counter_digit(c, i);
+        if(d < c->start){
+            *d = '0';
+            c->start = d;
+        }
+
+        unsigned sum = *d - '0' + (i < c->nstep ? c->step[i] : 0) + carry;
+        carry = sum >= 10;
+        *d    = '0' + sum - 10*carry;
+    }
+}
+
+/**
+ * Subtract step from magnitude, propagating the borrow through the ASCII
+ * digits. A borrow out of the top means the step was larger: the digits then
+ * hold the ten's complement of the result, which is undone and the sign
+ * flipped. Leading zeros are dropped, and zero is never negative.
+ * @param   c           Pointer to Counter structure
+ **/
+static void counter_subtract(Counter *c) {
+    unsigned borrow = 0;
+
+    for(size_t i = 0; i < c->nstep || borrow; i++){
+        char *d = counter_digit(c, i);
+        if(d < c->start){
+            if(i >= c->nstep) break;
+            *d = '0';
+            c->start = d;
+        }
+
+        unsigned sub  = (i < c->nstep ? c->step[i] : 0) + borrow;
+        unsigned have = *d - '0';
+        borrow = have < sub;
+        *d     = '0' + have + 10*borrow - sub;
+    }
+
+    if(borrow){
+        bool nonzero = false;
+        for(size_t i = 0; counter_digit(c, i) >= c->start; i++){
+            char *d = counter_digit(c, i);
+            if(nonzero){
+                *d = '0' + 9 - (*d - '0');
+            }
+            else if(*d != '0'){
+                *d = '0' + 10 - (*d - '0');
+                nonzero = true;
+            }
+        }
+        c->negative = !c->negative;
+    }
+
+    while(c->start < c->minimum && *c->start == '0') c->start++;
+
+    if(c->start == c->minimum && *c->start == '0'){
+        const char *p = c->start;
+        while(p < c->end && (*p == '0' || *p == '.')) p++;
+        if(p == c->end) c->negative = false;
+    }
+}
+
+/* Counter Functions */
+
+/**
+ * Initialize counter at first value. The text of the magnitude always has a
+ * digit before the decimal point and scale digits after it.
+ * @param   c           Pointer to Counter structure
+ * @param   first       Pointer to first Decimal
+ * @param   step        Pointer to step Decimal (same scale as first)
+ * @param   last        Pointer to last Decimal (bounds the magnitude)
+ **/
+void    counter_init(Counter *c, const Decimal *first, const Decimal *step, const Decimal *last) {
+    size_t scale    = first->scale;
+    size_t integer  = first->length > scale ? first->length - scale : 1;
+    size_t bound    = last->length > last->scale ? last->length - last->scale : 1;
+    if(bound > integer) integer = bound;
+    if(step->length > scale && step->length - scale > integer) integer = step->length - scale;
+
+    // Room for one more integer digit than any value has, and the point
+    size_t capacity = integer + 1 + scale + 1;
+    *c = (Counter){
+        .buffer     = malloc(capacity + COUNTER_SLACK),
+        .scale      = scale,
+        .negative   = first->negative,
+        .descending = step->negative,
+        .step       = malloc(step->length),
+        .nstep      = step->length,
+    };
+    c->end     = c->buffer + capacity;
+    c->minimum = c->end - (scale ? scale + 2 : 1);
+
+    char  *p = c->end;
+    size_t n = first->length > scale + 1 ? first->length : scale + 1;
+    for(size_t i = 0; i < n; i++){
+        if(scale && i == scale) *--p = '.';
+        *--p = i < first->length ? first->digits[first->length - 1 - i] : '0';
+    }
+    c->start = p;
+
+    for(size_t i = 0; i < step->length; i++){
+        c->step[i] = step->digits[step->length - 1 - i] - '0';
+    }
+}
+
+/**
+ * Deallocate counter.
+ * @param   c           Pointer to Counter structure
+ **/
+void    counter_delete(Counter *c) {
+    free(c->buffer);
+    free(c->step);
+}
+
+/**
+ * Step counter to the next value. The magnitude grows or shrinks by the
+ * digits of the step.
+ * @param   c           Pointer to Counter structure
+ **/
+void    counter_next(Counter *c) {
+    if(c->negative == c->descending){
+        counter_add(c);
+    }
+    else{
+        counter_subtract(c);
+    }
+}
+
+/**
+ * Length of text of magnitude.
+ * @param   c           Pointer to Counter structure
+ * @return  Number of characters.
+ **/
+size_t  counter_length(const Counter *c) {
+    return c->end - c->start;
+}
+
+/**
+ * Upper bound on the bytes written for a plain record, including the sign
+ * and the slack of fixed-size copies.
+ * @param   c           Pointer to Counter structure
+ * @return  Number of bytes.
+ **/
+size_t  counter_size(const Counter *c) {
+    return 1 + (c->end - c->buffer) + COUNTER_SLACK;
+}
+
+/**
+ * Write plain records, each followed by the separator, while there is a next
+ * value and the buffer is not full. While only the last digit of a growing
+ * magnitude changes, the counter is left alone and each record is a copy of
+ * its text with the last digit replaced; short texts are copied in one
+ * fixed-size piece (only the record length is kept), so the loop makes no
+ * calls.
+ * @param   c           Pointer to Counter structure (left at the first value
+ * not written)
+ * @param   buffer      Buffer (with counter_size + nseparator bytes of room
+ * past size)
+ * @param   size        Number of bytes to fill
+ * @param   separator   String between numbers
+ * @param   nseparator  Length of separator
+ * @param   remaining   Pointer to number of values after the current one
+ * (reduced by the number of records written)
+ * @return  Number of bytes written.
+ **/
+size_t  counter_fill(Counter *c, char *buffer, size_t size, const char *separator, size_t nseparator, uint64_t *remaining) {
+    char       *p    = buffer;
+    const char *end  = buffer + size;
+    char       *last = c->end - 1;
+
+    while(*remaining && p < end){
+        const char *start    = c->start;
+        size_t      n        = counter_length(c);
+        bool        negative = c->negative;
+        bool        run      = c->nstep == 1 && negative == c->descending;
+        char        step     = c->step[0];
+        char        digit    = *last;
+        uint64_t    limit    = *remaining;
+        uint64_t    count    = 0;
+
+        // Run of records (the last one steps the counter as usual)
+        do{
+            if(negative) *p++ = '-';
+            memcpy(p, start, COUNTER_SLACK);
+            if(n > COUNTER_SLACK) memcpy(p + COUNTER_SLACK, start + COUNTER_SLACK, n - COUNTER_SLACK);
+            p[n - 1] = digit;
+            p += n;
+
+            if(nseparator == 1){
+                *p++ = *separator;
+            }
+            else{
+                memcpy(p, separator, nseparator);
+                p += nseparator;
+            }
+
+            count++;
+            digit += step;
+        } while(run && digit <= '9' && count < limit && p < end);
+
+        *remaining -= count;
+        *last       = digit - step;
+        counter_next(c);
+    }
+    return p - buffer;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
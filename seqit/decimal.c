@@ -0,0 +1,325 @@
+/* decimal.c: Exact decimal numbers of any size */
+
+#include "seqit.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Constants */
+
+#define DECIMAL_EXPONENT    4096    // Largest exponent accepted
+
+/* Internal Functions */
+
+/**
+ * Allocate magnitude with leading zeros removed ("0" for zero).
+ * @param   s           Digits
+ * @param   n           Number of digits
+ * @param   zeros       Number of zeros to append
+ * @param   length      Pointer to length of magnitude
+ * @return  Allocated magnitude.
+ **/
+static char *decimal_digits(const char *s, size_t n, size_t zeros, size_t *length) {
+    while(n > 1 && *s == '0'){
+        s++;
+        n--;
+    }
+    if(n == 1 && *s == '0') zeros = 0;
+
+    char *digits = malloc(n + zeros + 1);
+    memcpy(digits, s, n);
+    memset(digits + n, '0', zeros);
+    digits[n + zeros] = 0;
+
+    *length = n + zeros;
+    return digits;
+}
+
+/**
+ * Compare magnitudes.
+ * @param   a           Digits of first magnitude (no leading zeros)
+ * @param   alength     Number of digits of a
+ * @param   b           Digits of second magnitude (no leading zeros)
+ * @param   blength     Number of digits of b
+ * @return  Negative, zero or positive as a is less than, equal to or greater
+ * than b.
+ **/
+static int decimal_compare(const char *a, size_t alength, const char *b, size_t blength) {
+    if(alength != blength) return alength < blength ? -1 : 1;
+    return memcmp(a, b, alength);
+}
+
+/**
+ * Subtract magnitudes in place: a -= b, where a >= b.
+ * @param   a           Digits of larger magnitude (modified)
+ * @param   alength     Pointer to number of digits of a (updated)
+ * @param   b           Digits of smaller magnitude
+ * @param   blength     Number of digits of b
+ **/
+static void decimal_subtract(char *a, size_t *alength, const char *b, size_t blength) {
+    int borrow = 0;
+
+    for(size_t i = 0; i < *alength; i++){
+        int d = a[*alength - 1 - i] - '0' - borrow - (i < blength ? b[blength - 1 - i] - '0' : 0);
+        borrow = d < 0;
+        a[*alength - 1 - i] = '0' + d + 10*borrow;
+    }
+
+    size_t zeros = 0;
+    while(zeros + 1 < *alength && a[zeros] == '0') zeros++;
+    memmove(a, a + zeros, *alength - zeros + 1);
+    *alength -= zeros;
+}
+
+/**
+ * Add magnitudes: a + b.
+ * @param   a           Digits of first magnitude
+ * @param   alength     Number of digits of a
+ * @param   b           Digits of second magnitude
+ * @param   blength     Number of digits of b
+ * @param   length      Pointer to number of digits of sum
+ * @return  Allocated sum.
+ **/
+static char *decimal_add(const char *a, size_t alength, const char *b, size_t blength, size_t *length) {
+    size_t n     = (alength > blength ? alength : blength) + 1;
+    char  *sum   = malloc(n + 1);
+    int    carry = 0;
+
+    for(size_t i = 0; i < n; i++){
+        int d = carry + (i < alength ? a[alength - 1 - i] - '0' : 0) + (i < blength ? b[blength - 1 - i] - '0' : 0);
+        carry = d >= 10;
+        sum[n - 1 - i] = '0' + d - 10*carry;
+    }
+    sum[n] = 0;
+
+    char *digits = decimal_digits(sum, n, 0, length);
+    free(sum);
+    return digits;
+}
+
+/**
+ * Add signed magnitudes: (a, anegative) + (b, bnegative).
+ * @param   a           Digits of first magnitude
+ * @param   alength     Number of digits of a
+ * @param   anegative   Whether first value is negative
+ * @param   b           Digits of second magnitude
+ * @param   blength     Number of digits of b
+ * @param   bnegative   Whether second value is negative
+ * @param   length      Pointer to number of digits of sum
+ * @param   negative    Pointer to whether sum is negative (never for zero)
+ * @return  Allocated magnitude of sum.
+ **/
+static char *decimal_sum(const char *a, size_t alength, bool anegative, const char *b, size_t blength, bool bnegative, size_t *length, bool *negative) {
+    char *sum;
+
+    if(anegative == bnegative){
+        sum       = decimal_add(a, alength, b, blength, length);
+        *negative = anegative;
+    }
+    else if(decimal_compare(a, alength, b, blength) >= 0){
+        sum       = decimal_digits(a, alength, 0, length);
+        decimal_subtract(sum, length, b, blength);
+        *negative = anegative;
+    }
+    else{
+        sum       = decimal_digits(b, blength, 0, length);
+        decimal_subtract(sum, length, a, alength);
+        *negative = bnegative;
+    }
+
+    if(*length == 1 && sum[0] == '0') *negative = false;
+    return sum;
+}
+
+/* Decimal Functions */
+
+/**
+ * Parse decimal number: an optional sign, digits with an optional decimal
+ * point, and an optional exponent. Nothing else is accepted.
+ * @param   d           Pointer to Decimal structure
+ * @param   s           Number string
+ * @return  true if s is a valid number (otherwise an error was printed).
+ **/
+bool    decimal_parse(Decimal *d, const char *s) {
+    const char *p = s;
+    char       *mantissa = malloc(strlen(s) + 1);
+    size_t      ndigits = 0, nfraction = 0, nwidth = 0;
+    long        exponent = 0;
+    bool        point = false;
+
+    *d = (Decimal){.negative = *p == '-'};
+    if(*p == '-' || *p == '+') p++;
+
+    for(; (*p >= '0' && *p <= '9') || (*p == '.' && !point); p++){
+        if(*p == '.'){
+            point = true;
+            continue;
+        }
+        mantissa[ndigits++] = *p;
+        if(point){
+            nfraction++;
+        }
+        else{
+            nwidth++;
+        }
+    }
+
+    if(ndigits && (*p == 'e' || *p == 'E')){
+        char *end;
+        exponent = strtol(p + 1, &end, 10);
+        if(end == p + 1 || p[1] == ' ' || p[1] == '\t' || exponent > DECIMAL_EXPONENT || exponent < -DECIMAL_EXPONENT){
+            ndigits = 0;
+        }
+        p = end;
+    }
+
+    if(ndigits == 0 || *p){
+        fprintf(stderr, "seqit: invalid floating point argument: '%s'\n", s);
+        free(mantissa);
+        return false;
+    }
+
+    // Value is mantissa * 10^(exponent - nfraction)
+    long scale = (long)nfraction - exponent;
+    d->digits = decimal_digits(mantissa, ndigits, scale < 0 ? -scale : 0, &d->length);
+    d->scale  = scale < 0 ? 0 : scale;
+    d->width  = exponent ? (d->length > d->scale ? d->length - d->scale : 1) : (nwidth ? nwidth : 1);
+    d->width += d->negative;
+    if(decimal_zero(d)) d->negative = false;
+
+    free(mantissa);
+    return true;
+}
+
+/**
+ * Add fraction digits (multiplying the magnitude by powers of ten).
+ * @param   d           Pointer to Decimal structure
+ * @param   scale       New number of fraction digits (at least the current)
+ **/
+void    decimal_rescale(Decimal *d, size_t scale) {
+    if(scale <= d->scale) return;
+
+    size_t zeros = decimal_zero(d) ? 0 : scale - d->scale;
+    d->digits = realloc(d->digits, d->length + zeros + 1);
+    memset(d->digits + d->length, '0', zeros);
+    d->length += zeros;
+    d->digits[d->length] = 0;
+    d->scale   = scale;
+}
+
+/**
+ * Whether decimal is zero.
+ * @param   d           Pointer to Decimal structure
+ * @return  true if d is zero.
+ **/
+bool    decimal_zero(const Decimal *d) {
+    return d->length == 1 && d->digits[0] == '0';
+}
+
+/**
+ * Number of steps from first to last: floor((last - first) / step), computed
+ * exactly by long division on the digits.
+ * @param   first       Pointer to first Decimal
+ * @param   step        Pointer to step Decimal (not zero)
+ * @param   last        Pointer to last Decimal
+ * @param   steps       Pointer to number of steps (UINT64_MAX if there are
+ * more)
+ * @return  false if the sequence is empty.
+ **/
+bool    decimal_steps(const Decimal *first, const Decimal *step, const Decimal *last, uint64_t *steps) {
+    size_t scale = first->scale;
+    if(step->scale > scale) scale = step->scale;
+    if(last->scale > scale) scale = last->scale;
+
+    // Bring magnitudes to a common scale
+    size_t nfirst, nstep, nlast;
+    char  *a = decimal_digits(first->digits, first->length, scale - first->scale, &nfirst);
+    char  *b = decimal_digits(step->digits, step->length, scale - step->scale, &nstep);
+    char  *z = decimal_digits(last->digits, last->length, scale - last->scale, &nlast);
+
+    // span = last - first
+    size_t length;
+    bool   negative;
+    char  *span  = decimal_sum(z, nlast, last->negative, a, nfirst, !first->negative, &length, &negative);
+    bool   zero  = length == 1 && span[0] == '0';
+    bool   empty = !zero && negative != step->negative;
+
+    // Long division: remainder takes one more digit of span at a time
+    char  *remainder  = malloc(length + 2);
+    size_t nremainder = 0;
+
+    *steps = 0;
+    for(size_t i = 0; i < length && !empty; i++){
+        if(nremainder == 1 && remainder[0] == '0') nremainder = 0;
+        remainder[nremainder++] = span[i];
+        remainder[nremainder]   = 0;
+
+        int digit = 0;
+        while(decimal_compare(remainder, nremainder, b, nstep) >= 0){
+            decimal_subtract(remainder, &nremainder, b, nstep);
+            digit++;
+        }
+
+        *steps = *steps > (UINT64_MAX - digit) / 10 ? UINT64_MAX : 10 * *steps + digit;
+    }
+
+    free(remainder);
+    free(span);
+    free(a);
+    free(b);
+    free(z);
+    return !empty;
+}
+
+/**
+ * Term of sequence: first + i*step, computed exactly (the product by
+ * schoolbook multiplication on the digits).
+ * @param   d           Pointer to Decimal structure to set
+ * @param   first       Pointer to first Decimal
+ * @param   step        Pointer to step Decimal (same scale as first)
+ * @param   i           Index of term
+ **/
+void    decimal_term(Decimal *d, const Decimal *first, const Decimal *step, uint64_t i) {
+    char   index[24];
+    size_t nindex = snprintf(index, sizeof(index), "%" PRIu64, i);
+
+    // Column sums of the product, least significant first
+    size_t    n       = step->length + nindex;
+    unsigned *columns = calloc(n, sizeof(unsigned));
+    for(size_t a = 0; a < step->length; a++){
+        for(size_t b = 0; b < nindex; b++){
+            columns[a + b] += (step->digits[step->length - 1 - a] - '0') * (index[nindex - 1 - b] - '0');
+        }
+    }
+
+    char    *product = malloc(n + 1);
+    unsigned carry   = 0;
+    for(size_t k = 0; k < n; k++){
+        unsigned column = columns[k] + carry;
+        product[n - 1 - k] = '0' + column % 10;
+        carry = column / 10;
+    }
+    product[n] = 0;
+
+    size_t nproduct;
+    char  *digits = decimal_digits(product, n, 0, &nproduct);
+
+    *d = (Decimal){.scale = first->scale};
+    d->digits = decimal_sum(first->digits, first->length, first->negative, digits, nproduct, step->negative, &d->length, &d->negative);
+    d->width  = first->width;
+
+    free(digits);
+    free(product);
+    free(columns);
+}
+
+/**
+ * Deallocate decimal.
+ * @param   d           Pointer to Decimal structure
+ **/
+void    decimal_delete(Decimal *d) {
+    free(d->digits);
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,238 @@
+/* format.c: Format numbers of a sequence without printf */
+
+#include "seqit.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Internal Functions */
+
+/**
+ * Copy literal text of format, turning each %% into %.
+ * @param   s           Start of text
+ * @param   n           Length of text
+ * @param   length      Pointer to length of copy
+ * @return  Allocated copy of text.
+ **/
+static char *format_text(const char *s, size_t n, size_t *length) {
+    char *text = malloc(n + 1);
+    char *p    = text;
+
+    for(size_t i = 0; i < n; i++){
+        *p++ = s[i];
+        if(s[i] == '%') i++;
+    }
+    *p = 0;
+
+    *length = p - text;
+    return text;
+}
+
+/**
+ * Text printed by %g for magnitude, when it has no exponent and needs no
+ * rounding: the digits without trailing fraction zeros.
+ * @param   f           Pointer to Format structure
+ * @param   c           Pointer to Counter structure
+ * @param   length      Pointer to length of text
+ * @return  true if %g prints the magnitude this way.
+ **/
+static bool format_shortest(const Format *f, const Counter *c, size_t *length) {
+    const char *s = c->start;
+    const char *e = c->end;
+    size_t      precision = f->precision < 0 ? 6 : f->precision ? f->precision : 1;
+
+    if(c->scale){
+        while(e[-1] == '0') e--;
+        if(e[-1] == '.') e--;
+    }
+    *length = e - s;
+
+    // Zero, or integer and fraction digits counted from the first nonzero
+    const char *nonzero = s;
+    while(nonzero < e && (*nonzero == '0' || *nonzero == '.')) nonzero++;
+    if(nonzero == e) return true;
+
+    const char *point = memchr(s, '.', e - s);
+    size_t      significant = (e - nonzero) - (point && point > nonzero);
+
+    // Exponent X is used unless -4 <= X < precision
+    if(*s != '0'){
+        return (size_t)((point ? point : e) - s) <= precision && significant <= precision;
+    }
+    return nonzero - point <= 4 && significant <= precision;
+}
+
+/* Format Functions */
+
+/**
+ * Parse -f format: literal text with exactly one floating point conversion
+ * (%e, %f, %g or %a, with optional flags, width and precision), as accepted
+ * by seq.
+ * @param   f           Pointer to Format structure
+ * @param   s           Format string
+ * @return  true if format is valid (otherwise an error was printed).
+ **/
+bool    format_parse(Format *f, const char *s) {
+    const char *spec = NULL;
+    const char *end  = NULL;
+    bool        alternate = false;
+
+    *f = (Format){.precision = -1};
+
+    for(const char *p = s; *p; p++){
+        if(*p != '%') continue;
+        if(p[1] == '%'){
+            p++;
+            continue;
+        }
+        if(spec){
+            fprintf(stderr, "seqit: format '%s' has too many %% directives\n", s);
+            return false;
+        }
+
+        spec = p++;
+        for(; *p && strchr("-+ #0'", *p); p++){
+            switch(*p){
+                case '-': f->left = true; break;
+                case '+': f->sign = '+'; break;
+                case ' ': if(!f->sign) f->sign = ' '; break;
+                case '0': f->zero = true; break;
+                default:  alternate = true; break;
+            }
+        }
+        for(; *p >= '0' && *p <= '9'; p++) f->width = 10*f->width + *p - '0';
+        if(*p == '.'){
+            f->precision = 0;
+            for(p++; *p >= '0' && *p <= '9'; p++) f->precision = 10*f->precision + *p - '0';
+        }
+
+        if(!*p || !strchr("eEfFgGaA", *p)){
+            fprintf(stderr, "seqit: format '%s' has unknown %%%c directive\n", s, *p ? *p : '%');
+            return false;
+        }
+        f->conversion = *p;
+        end = p + 1;
+    }
+
+    if(!spec){
+        fprintf(stderr, "seqit: format '%s' has no %% directive\n", s);
+        return false;
+    }
+
+    // Alternate forms are left to printf
+    if(alternate) f->conversion = 'a';
+
+    f->prefix = format_text(s, spec - s, &f->nprefix);
+    f->suffix = format_text(end, strlen(end), &f->nsuffix);
+
+    // printf format with a long double conversion
+    size_t n = strlen(s);
+    f->fallback = malloc(n + 2);
+    memcpy(f->fallback, s, end - 1 - s);
+    f->fallback[end - 1 - s] = 'L';
+    memcpy(f->fallback + (end - s), end - 1, n - (end - 1 - s) + 1);
+    return true;
+}
+
+/**
+ * Deallocate format text.
+ * @param   f           Pointer to Format structure
+ **/
+void    format_delete(Format *f) {
+    free(f->prefix);
+    free(f->suffix);
+    free(f->fallback);
+}
+
+/**
+ * Upper bound on the length of a record.
+ * @param   f           Pointer to Format structure
+ * @param   c           Pointer to Counter structure
+ * @return  Number of bytes format_record may write.
+ **/
+size_t  format_size(const Format *f, const Counter *c) {
+    size_t precision = f->precision < 0 ? 6 : f->precision;
+    return f->nprefix + f->nsuffix + f->width + counter_size(c) + precision + 32;
+}
+
+/**
+ * Format current value of counter: prefix, padding, sign, digits, zero
+ * fraction and suffix are copied into place, so printf (given the value as
+ * a long double) is only needed for exponents, rounding and alternate forms.
+ * @param   f           Pointer to Format structure
+ * @param   c           Pointer to Counter structure
+ * @param   buffer      Buffer (with room for format_size bytes)
+ * @return  Length of record.
+ **/
+size_t  format_record(const Format *f, const Counter *c, char *buffer) {
+    size_t n        = counter_length(c);
+    size_t fraction = 0;
+    bool   point    = false;
+    bool   general  = false;
+
+    switch(f->conversion){
+        case 0:
+            break;
+        case 'f':
+        case 'F':
+            // Digits beyond the scale are zeros; fewer need rounding
+            fraction = f->precision < 0 ? 6 : f->precision;
+            general  = fraction < c->scale;
+            point    = fraction && !c->scale;
+            fraction = general ? 0 : fraction - c->scale;
+            break;
+        case 'g':
+        case 'G':
+            general = !format_shortest(f, c, &n);
+            break;
+        default:
+            general = true;
+            break;
+    }
+
+    if(general){
+        char *p = buffer;
+        if(c->negative) *p++ = '-';
+        memcpy(p, c->start, counter_length(c));
+        p[counter_length(c)] = 0;
+        return snprintf(buffer, format_size(f, c), f->fallback, strtold(buffer, NULL));
+    }
+
+    char   sign  = c->negative ? '-' : f->sign;
+    size_t field = (sign != 0) + n + point + fraction;
+    size_t pad   = f->width > field ? f->width - field : 0;
+    char  *p     = buffer;
+
+    if(f->nprefix){
+        memcpy(p, f->prefix, f->nprefix);
+        p += f->nprefix;
+    }
+    if(pad && !f->left && !f->zero){
+        memset(p, ' ', pad);
+        p += pad;
+    }
+    if(sign) *p++ = sign;
+    if(pad && !f->left && f->zero){
+        memset(p, '0', pad);
+        p += pad;
+    }
+
+    memcpy(p, c->start, n);
+    p += n;
+    if(point) *p++ = '.';
+    memset(p, '0', fraction);
+    p += fraction;
+
+    if(pad && f->left){
+        memset(p, ' ', pad);
+        p += pad;
+    }
+    if(f->nsuffix){
+        memcpy(p, f->suffix, f->nsuffix);
+        p += f->nsuffix;
+    }
+
+    return p - buffer;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,204 @@
+/* parallel.c: Generate chunks of a sequence on several threads */
+
+#include "seqit.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define CHUNK_BYTES (1 << 22)   // Upper bound on bytes formatted per chunk
+
+/* Parallel Structure */
+
+typedef struct {
+    const Decimal   *first;     // First value
+    const Decimal   *step;      // Step (same scale as first)
+    const Decimal   *last;      // Last value
+    const Format    *format;    // Format (NULL for plain numbers)
+    const char      *separator; // String between numbers
+    size_t           nseparator;// Length of separator
+    uint64_t         steps;     // Number of steps from first to last
+    uint64_t         chunk;     // Number of records per chunk
+    uint64_t         nchunks;   // Number of chunks
+    size_t           record;    // Upper bound on bytes per record
+    int              fd;        // File descriptor to write to
+    bool             positioned;// Whether chunks are written at offsets
+    pthread_mutex_t  lock;      // Guards the fields below
+    pthread_cond_t   turn;      // Signalled when a chunk is published
+    uint64_t         next;      // Next chunk to generate
+    uint64_t         published; // Number of chunks given their place
+    off_t            offset;    // Offset of next chunk
+    bool             failed;    // Whether a write failed
+} Parallel;
+
+/* Internal Functions */
+
+/**
+ * Write all of buffer, at offset if positioned.
+ * @param   p           Pointer to Parallel structure
+ * @param   buffer      Bytes to write
+ * @param   n           Number of bytes
+ * @param   offset      Offset in file (if positioned)
+ * @return  true if every byte was written (otherwise an error was printed).
+ **/
+static bool parallel_write(const Parallel *p, const char *buffer, size_t n, off_t offset) {
+    while(n){
+        ssize_t nwritten = p->positioned ? pwrite(p->fd, buffer, n, offset) : write(p->fd, buffer, n);
+        if(nwritten < 0){
+            if(errno == EINTR) continue;
+            perror("seqit: write");
+            return false;
+        }
+        buffer += nwritten;
+        offset += nwritten;
+        n      -= nwritten;
+    }
+    return true;
+}
+
+/**
+ * Thread function: take the next chunk, format its records starting from
+ * their exact first value, and wait for the chunks before it to be placed.
+ * The offset of a chunk is the sum of the lengths of the chunks before it,
+ * so a positioned chunk is written with pwrite outside the lock while the
+ * next ones are still being formatted; otherwise chunks are written in turn.
+ * @param   arg         Pointer to Parallel structure
+ * @return  NULL.
+ **/
+static void *parallel_thread(void *arg) {
+    Parallel *p      = arg;
+    char     *buffer = malloc((p->chunk + 1) * p->record);
+
+    while(true){
+        // Decide under the lock: a chunk once claimed is always published,
+        // or the threads holding later chunks would wait for it forever
+        pthread_mutex_lock(&p->lock);
+        uint64_t k    = p->next;
+        bool     stop = k >= p->nchunks || p->failed;
+        if(!stop) p->next++;
+        pthread_mutex_unlock(&p->lock);
+        if(stop) break;
+
+        // Records after the first one of the chunk
+        uint64_t index     = k * p->chunk;
+        bool     final     = k + 1 == p->nchunks;
+        uint64_t remaining = final ? p->steps - index : p->chunk - 1;
+        Decimal  value;
+        Counter  counter;
+
+        decimal_term(&value, p->first, p->step, index);
+        counter_init(&counter, &value, p->step, p->last);
+
+        size_t n = 0;
+        while(remaining){
+            n += sequence_fill(&counter, p->format, p->separator, p->nseparator, &remaining, buffer + n, p->chunk * p->record - n);
+        }
+        n += sequence_record(&counter, p->format, buffer + n);
+        if(final){
+            buffer[n++] = '\n';
+        }
+        else{
+            memcpy(buffer + n, p->separator, p->nseparator);
+            n += p->nseparator;
+        }
+
+        counter_delete(&counter);
+        decimal_delete(&value);
+
+        // Take place after the chunks before this one
+        pthread_mutex_lock(&p->lock);
+        while(p->published != k) pthread_cond_wait(&p->turn, &p->lock);
+        off_t offset = p->offset;
+        bool  write  = !p->failed;
+        p->offset   += n;
+        if(!p->positioned && write && !parallel_write(p, buffer, n, offset)){
+            p->failed = true;
+        }
+        p->published++;
+        pthread_cond_broadcast(&p->turn);
+        pthread_mutex_unlock(&p->lock);
+
+        if(p->positioned && write && !parallel_write(p, buffer, n, offset)){
+            pthread_mutex_lock(&p->lock);
+            p->failed = true;
+            pthread_mutex_unlock(&p->lock);
+        }
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+/* Functions */
+
+/**
+ * Output sequence formatted in chunks on several threads, in order. Each
+ * chunk starts at its exact term (first + index*step), so the output is the
+ * same as generate_sequence. Regular files are written at precomputed
+ * offsets; pipes and terminals are written one chunk at a time in order.
+ * @param   first       Pointer to first Decimal
+ * @param   step        Pointer to step Decimal (same scale as first)
+ * @param   last        Pointer to last Decimal
+ * @param   format      Pointer to Format structure (NULL for plain numbers)
+ * @param   separator   String between numbers
+ * @param   fd          File descriptor to write to
+ * @param   jobs        Number of threads
+ * @return  true if the whole sequence was written.
+ **/
+bool generate_parallel(const Decimal *first, const Decimal *step, const Decimal *last, const Format *format, const char *separator, int fd, size_t jobs) {
+    Parallel p = {
+        .first      = first,
+        .step       = step,
+        .last       = last,
+        .format     = format,
+        .separator  = separator,
+        .nseparator = strlen(separator),
+        .fd         = fd,
+    };
+
+    if(!decimal_steps(first, step, last, &p.steps)) return true;
+
+    // Every value fits the counter of the whole sequence
+    Counter counter;
+    counter_init(&counter, first, step, last);
+    p.record = sequence_size(&counter, format) + p.nseparator;
+    counter_delete(&counter);
+
+    p.chunk   = CHUNK_BYTES / p.record ? CHUNK_BYTES / p.record : 1;
+    p.nchunks = p.steps / p.chunk + 1;
+
+    // Regular files (not appended to) are written at offsets from here
+    struct stat st;
+    p.offset     = lseek(fd, 0, SEEK_CUR);
+    p.positioned = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && p.offset >= 0 && !(fcntl(fd, F_GETFL) & O_APPEND);
+
+    if(jobs > p.nchunks) jobs = p.nchunks;
+    pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.turn, NULL);
+
+    size_t started = 0;
+    for(; started < jobs; started++){
+        if(pthread_create(&threads[started], NULL, parallel_thread, &p) != 0) break;
+    }
+    if(started == 0) parallel_thread(&p);
+    for(size_t i = 0; i < started; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    // Leave the file offset after the sequence, as write would
+    if(p.positioned) lseek(fd, p.offset, SEEK_SET);
+
+    pthread_cond_destroy(&p.turn);
+    pthread_mutex_destroy(&p.lock);
+    free(threads);
+    return !p.failed;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -1,81 +1,246 @@
 /* seqit.c: Print a sequence of numbers */
 
-#include "list.h"
+#define _GNU_SOURCE  // F_SETPIPE_SZ
+
+#include "seqit.h"
 
-#include <stdbool.h>
-#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define BLOCK_SIZE  (1 << 20)   // Bytes formatted per write
 
 /* Functions */
 
 void usage(int status) {
-    fprintf(stderr, "Usage: seqit LAST\n");
-    fprintf(stderr, "       seqit FIRST LAST\n");
-    fprintf(stderr, "       seqit FIRST INCREMENT LAST\n");
+    fprintf(stderr, "Usage: seqit [OPTIONS] LAST\n");
+    fprintf(stderr, "       seqit [OPTIONS] FIRST LAST\n");
+    fprintf(stderr, "       seqit [OPTIONS] FIRST INCREMENT LAST\n\n");
+    fprintf(stderr, "    -w         Pad numbers with leading zeros to equal width\n");
+    fprintf(stderr, "    -s SEP     Separate numbers with SEP (default is a newline)\n");
+    fprintf(stderr, "    -f FORMAT  Print numbers with printf-style floating point FORMAT\n");
+    fprintf(stderr, "    -j N       Generate chunks of the sequence on N threads\n");
+    fprintf(stderr, "    -o FILE    Write to FILE instead of standard output\n");
     exit(status);
 }
 
-List *generate_sequence(ssize_t first, ssize_t increment, ssize_t last) {
-    
+/**
+ * Upper bound on the length of a record of sequence.
+ * @param   c           Pointer to Counter structure
+ * @param   format      Pointer to Format structure (NULL for plain numbers)
+ * @return  Number of bytes sequence_record (or each record of sequence_fill)
+ * may write.
+ **/
+size_t sequence_size(const Counter *c, const Format *format) {
+    return format ? format_size(format, c) : counter_size(c);
+}
 
-    List *l = list_create();
-    Value v;
-    
-    if(increment > 0){
-        for(int i=first; i<=last; i+=increment){
-            v.number = i;
-            list_append(l, v);
-        }
+/**
+ * Write current value of counter as a record.
+ * @param   c           Pointer to Counter structure
+ * @param   format      Pointer to Format structure (NULL for plain numbers)
+ * @param   buffer      Buffer (with room for sequence_size bytes)
+ * @return  Length of record.
+ **/
+size_t sequence_record(const Counter *c, const Format *format, char *buffer) {
+    if(format) return format_record(format, c, buffer);
+
+    char *p = buffer;
+    if(c->negative) *p++ = '-';
+    memcpy(p, c->start, counter_length(c));
+    return p + counter_length(c) - buffer;
+}
+
+/**
+ * Write records, each followed by the separator, while there is a next value
+ * and the buffer is not full.
+ * @param   c           Pointer to Counter structure (left at the first value
+ * not written)
+ * @param   format      Pointer to Format structure (NULL for plain numbers)
+ * @param   separator   String between numbers
+ * @param   nseparator  Length of separator
+ * @param   remaining   Pointer to number of values after the current one
+ * (reduced by the number of records written)
+ * @param   buffer      Buffer (with room for one more record and separator
+ * past size)
+ * @param   size        Number of bytes to fill
+ * @return  Number of bytes written.
+ **/
+size_t sequence_fill(Counter *c, const Format *format, const char *separator, size_t nseparator, uint64_t *remaining, char *buffer, size_t size) {
+    if(!format) return counter_fill(c, buffer, size, separator, nseparator, remaining);
+
+    char *p = buffer;
+    while(*remaining && p < buffer + size){
+        p += format_record(format, c, p);
+        memcpy(p, separator, nseparator);
+        p += nseparator;
+        counter_next(c);
+        (*remaining)--;
     }
-    else if(increment < 0){
-        for(int i=first; i>= last; i+=increment){
-            v.number = i;
-            list_append(l, v);
+    return p - buffer;
+}
+
+/**
+ * Output sequence as it is generated, in constant memory. The number of
+ * steps is computed exactly up front, and each value is the exact decimal
+ * sum of first and the steps so far, so there is no drift. Records are
+ * formatted from the digits of a decimal counter straight into a large block
+ * that is written at once.
+ * @param   first       Pointer to first Decimal
+ * @param   step        Pointer to step Decimal (same scale as first)
+ * @param   last        Pointer to last Decimal
+ * @param   format      Pointer to Format structure (NULL for plain numbers)
+ * @param   separator   String between numbers
+ * @param   output      Pointer to Output structure
+ **/
+void generate_sequence(const Decimal *first, const Decimal *step, const Decimal *last, const Format *format, const char *separator, Output *output) {
+    uint64_t remaining;
+    Counter  counter;
+
+    if(!decimal_steps(first, step, last, &remaining)) return;
+    counter_init(&counter, first, step, last);
+
+    size_t nseparator = strlen(separator);
+    char  *block      = malloc(BLOCK_SIZE + sequence_size(&counter, format) + nseparator);
+    size_t used       = 0;
+
+    while(remaining){
+        used += sequence_fill(&counter, format, separator, nseparator, &remaining, block + used, BLOCK_SIZE - used);
+        if(used >= BLOCK_SIZE){
+            output_write(output, block, used);
+            used = 0;
         }
     }
-    
-    return l;
+
+    // Last number ends the line instead
+    used += sequence_record(&counter, format, block + used);
+    block[used++] = '\n';
+
+    output_write(output, block, used);
+    free(block);
+    counter_delete(&counter);
 }
 
 /* Main Execution */
 
 int main(int argc, char *argv[]) {
 
-    ssize_t first = 1;
-    ssize_t increment = 1;
-    ssize_t last;
+    const char *separator = "\n";
+    const char *pattern = NULL;
+    const char *path = NULL;
+    bool equal = false;
+    long jobs = 1;
+    int fd = STDOUT_FILENO;
+    int status = EXIT_SUCCESS;
+    Decimal first, step, last;
+    Format format;
+    Output output;
+    int argind = 1;
     
+    // Parse command line arguments (negative numbers are not options)
+    for(; argind < argc && argv[argind][0] == '-' && argv[argind][1] && !strchr("0123456789.", argv[argind][1]); argind++){
+        char *arg = argv[argind];
+        
+        if(strcmp(arg, "-h") == 0){
+            usage(0);
+        }
+        else if(strcmp(arg, "-w") == 0){
+            equal = true;
+        }
+        else if(strncmp(arg, "-s", 2) == 0 && (arg[2] || argind + 1 < argc)){
+            separator = arg[2] ? arg + 2 : argv[++argind];
+        }
+        else if(strncmp(arg, "-f", 2) == 0 && (arg[2] || argind + 1 < argc)){
+            pattern = arg[2] ? arg + 2 : argv[++argind];
+        }
+        else if(strncmp(arg, "-j", 2) == 0 && (arg[2] || argind + 1 < argc)){
+            jobs = strtol(arg[2] ? arg + 2 : argv[++argind], NULL, 10);
+            if(jobs < 1) usage(1);
+        }
+        else if(strcmp(arg, "-o") == 0 && argind + 1 < argc){
+            path = argv[++argind];
+        }
+        else{
+            usage(1);
+        }
+    }
+    argc -= argind - 1;
+    argv += argind - 1;
     
-    // Parse command line arguments
     if(argc == 1 || argc > 4){
         usage(1);
     }
-    else if(argc == 2){
-        last = strtol(argv[1], NULL, 10);
+    
+    // FIRST and INCREMENT default to 1
+    const char *first_arg = argc > 2 ? argv[1] : "1";
+    const char *step_arg  = argc > 3 ? argv[2] : "1";
+    if(!decimal_parse(&first, first_arg) || !decimal_parse(&step, step_arg) || !decimal_parse(&last, argv[argc - 1])){
+        usage(1);
+    }
+    if(decimal_zero(&step)){
+        fprintf(stderr, "seqit: invalid Zero increment value: '%s'\n", step_arg);
+        usage(1);
+    }
+    
+    if(equal && pattern){
+        fprintf(stderr, "seqit: format string may not be specified when printing equal width strings\n");
+        usage(1);
+    }
+    if(pattern && !format_parse(&format, pattern)){
+        return EXIT_FAILURE;
     }
-    else if(argc == 3){
-        first = strtol(argv[1], NULL, 10);
-        last = strtol(argv[2], NULL, 10);
+    
+    // Numbers are printed with the fraction digits of FIRST or INCREMENT
+    size_t scale = first.scale > step.scale ? first.scale : step.scale;
+    decimal_rescale(&first, scale);
+    decimal_rescale(&step, scale);
+    
+    if(equal){
+        // Zero-pad to the wider of the bounds
+        format = (Format){.zero = true, .precision = -1};
+        format.width = (first.width > last.width ? first.width : last.width) + (scale ? scale + 1 : 0);
     }
-    else if(argc == 4){
-        first = strtol(argv[1], NULL, 10);
-        increment = strtol(argv[2], NULL, 10);
-        last = strtol(argv[3], NULL, 10);
+    
+    if(path && (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0){
+        perror(path);
+        return EXIT_FAILURE;
     }
-    // Generate sequence
-    List *sequence = generate_sequence(first, increment, last);
     
-    // Print out sequence
-    Node *curr = sequence->sentinel.next;
+    // Let the reader of a pipe take whole blocks at once
+    struct stat st;
+    if(fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)){
+        fcntl(fd, F_SETPIPE_SZ, BLOCK_SIZE);
+    }
+    
+    // Print out sequence as it is generated
+    if(jobs > 1){
+        if(!generate_parallel(&first, &step, &last, pattern || equal ? &format : NULL, separator, fd, jobs)){
+            status = EXIT_FAILURE;
+        }
+    }
+    else{
+        output_init(&output, fd, 0, '\n', NULL);
+        generate_sequence(&first, &step, &last, pattern || equal ? &format : NULL, separator, &output);
+        output_delete(&output);
+        if(output.failed) status = EXIT_FAILURE;
+    }
     
-    while(curr != &sequence->sentinel){
-        printf("%ld\n", curr->value.number);
-        curr = curr->next;
+    if(path && close(fd) < 0){
+        perror(path);
+        status = EXIT_FAILURE;
     }
     
-    list_delete(sequence, false);
+    if(pattern || equal) format_delete(&format);
+    decimal_delete(&first);
+    decimal_delete(&step);
+    decimal_delete(&last);
     
-    return EXIT_SUCCESS;
+    return status;
 }
 
 /* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,83 @@
+/* seqit.h: Print a sequence of numbers */
+
+#pragma once
+
+#include "output.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Constants */
+
+#define COUNTER_SLACK   32          // Bytes copied at once per record
+
+/* Decimal Structure */
+
+typedef struct {
+    char   *digits;     // ASCII digits of |value| * 10^scale (no leading
+                        // zeros, "0" for zero)
+    size_t  length;     // Number of digits
+    size_t  scale;      // Number of fraction digits
+    size_t  width;      // Width of integer part as written, with sign (-w)
+    bool    negative;   // Whether value is negative
+} Decimal;
+
+bool    decimal_parse(Decimal *d, const char *s);
+void    decimal_rescale(Decimal *d, size_t scale);
+bool    decimal_zero(const Decimal *d);
+bool    decimal_steps(const Decimal *first, const Decimal *step, const Decimal *last, uint64_t *steps);
+void    decimal_term(Decimal *d, const Decimal *first, const Decimal *step, uint64_t i);
+void    decimal_delete(Decimal *d);
+
+/* Counter Structure */
+
+typedef struct {
+    char    *buffer;    // Text of magnitude (ending at end) and slack
+    char    *start;     // First character of magnitude
+    char    *end;       // End of magnitude
+    char    *minimum;   // Latest start (keeps "0" or "0." before fraction)
+    size_t   scale;     // Number of fraction digits (after a '.')
+    bool     negative;  // Whether value is negative
+    bool     descending;// Whether step is negative
+    uint8_t *step;      // Digits of |step|, least significant first
+    size_t   nstep;     // Number of digits in step
+} Counter;
+
+void    counter_init(Counter *c, const Decimal *first, const Decimal *step, const Decimal *last);
+void    counter_delete(Counter *c);
+void    counter_next(Counter *c);
+size_t  counter_length(const Counter *c);
+size_t  counter_size(const Counter *c);
+size_t  counter_fill(Counter *c, char *buffer, size_t size, const char *separator, size_t nseparator, uint64_t *remaining);
+
+/* Format Structure */
+
+typedef struct {
+    char       *prefix;     // Text before the number
+    size_t      nprefix;    // Length of prefix
+    char       *suffix;     // Text after the number
+    size_t      nsuffix;    // Length of suffix
+    char        sign;       // Sign of non-negative numbers ('+', ' ' or 0)
+    bool        left;       // Whether to pad on the right ('-' flag)
+    bool        zero;       // Whether to pad with zeros ('0' flag or -w)
+    size_t      width;      // Minimum field width
+    int         precision;  // Precision (-1 if not given)
+    char        conversion; // printf conversion (0 for plain numbers)
+    char       *fallback;   // printf format taking a long double
+} Format;
+
+bool    format_parse(Format *f, const char *s);
+void    format_delete(Format *f);
+size_t  format_size(const Format *f, const Counter *c);
+size_t  format_record(const Format *f, const Counter *c, char *buffer);
+
+/* Sequence Functions */
+
+size_t  sequence_size(const Counter *c, const Format *format);
+size_t  sequence_record(const Counter *c, const Format *format, char *buffer);
+size_t  sequence_fill(Counter *c, const Format *format, const char *separator, size_t nseparator, uint64_t *remaining, char *buffer, size_t size);
+void    generate_sequence(const Decimal *first, const Decimal *step, const Decimal *last, const Format *format, const char *separator, Output *output);
+bool    generate_parallel(const Decimal *first, const Decimal *step, const Decimal *last, const Format *format, const char *separator, int fd, size_t jobs);
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
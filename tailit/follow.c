@@ -0,0 +1,227 @@
+/* follow.c: Follow files as they grow */
+
+#include "tailit.h"
+
+#include <errno.h>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define FILE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define DIR_EVENTS  (IN_CREATE | IN_MOVED_TO)
+
+/* Internal Functions */
+
+/**
+ * Copy everything between the file position and the end of file to standard
+ * output. Data goes from the page cache to stdout with sendfile when the
+ * kernel supports it for the destination, and through a buffer otherwise.
+ * A file that shrank below the file position was truncated and is copied
+ * again from the start.
+ * @param   f           Pointer to Follow structure
+ * @param   output      Pointer to Output structure (flushed first)
+ * @param   last        Pointer to file output last, when following several
+ * files (a header is printed whenever output switches files), or NULL
+ **/
+static void follow_copy(Follow *f, Output *output, const Follow **last) {
+    struct stat st;
+    if(fstat(f->fd, &st) < 0) return;
+
+    off_t offset = lseek(f->fd, 0, SEEK_CUR);
+    if(st.st_size < offset){
+        fprintf(stderr, "tailit: %s: file truncated\n", follow_name(f));
+        lseek(f->fd, 0, SEEK_SET);
+        offset = 0;
+    }
+    if(offset >= st.st_size) return;
+
+    if(last && *last != f){
+        tail_header(follow_name(f), false, output);
+        *last = f;
+    }
+    // Destination cannot take sendfile: copy through a buffer instead
+    if(!tail_sendfile(f->fd, &offset, st.st_size, output)){
+        char    buffer[BUFSIZ];
+        ssize_t n;
+        while((n = pread(f->fd, buffer, BUFSIZ, offset)) > 0){
+            output_write(output, buffer, n);
+            offset += n;
+        }
+        output_flush(output);
+    }
+    lseek(f->fd, offset, SEEK_SET);
+}
+
+/**
+ * (Re)open followed file by name and watch it.
+ * @param   f           Pointer to Follow structure
+ * @param   inotify     inotify file descriptor
+ * @return  true if file is open.
+ **/
+static bool follow_open(Follow *f, int inotify) {
+    struct stat st;
+
+    f->fd = open(f->path, O_RDONLY | O_CLOEXEC);
+    if(f->fd < 0 || fstat(f->fd, &st) < 0){
+        if(f->fd >= 0) close(f->fd);
+        f->fd = -1;
+        return false;
+    }
+
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->wd  = inotify_add_watch(inotify, f->path, FILE_EVENTS);
+    return true;
+}
+
+/**
+ * Check whether the name of a file followed by name now refers to another
+ * file (rename-based rotation) or to nothing (deletion). The old file is
+ * drained before it is closed, and the new one is followed from its start.
+ * @param   f           Pointer to Follow structure
+ * @param   inotify     inotify file descriptor
+ * @param   output      Pointer to Output structure
+ * @param   last        Pointer to file output last (see follow_copy)
+ **/
+static void follow_check(Follow *f, int inotify, Output *output, const Follow **last) {
+    struct stat st;
+    bool exists = stat(f->path, &st) == 0;
+
+    if(f->fd >= 0 && exists && st.st_dev == f->dev && st.st_ino == f->ino){
+        return;
+    }
+
+    if(f->fd >= 0){
+        follow_copy(f, output, last);
+        inotify_rm_watch(inotify, f->wd);
+        close(f->fd);
+        f->fd = -1;
+        f->wd = -1;
+
+        if(!exists){
+            fprintf(stderr, "tailit: '%s' has become inaccessible\n", f->path);
+        }
+    }
+
+    if(exists && follow_open(f, inotify)){
+        fprintf(stderr, "tailit: '%s' has been replaced; following new file\n", f->path);
+    }
+}
+
+/* Follow Functions */
+
+/**
+ * Name of followed file for messages.
+ * @param   f           Pointer to Follow structure
+ * @return  File name or "standard input".
+ **/
+const char *follow_name(const Follow *f) {
+    return f->path ? f->path : "standard input";
+}
+
+/**
+ * Output data appended to files as it arrives, sleeping in inotify between
+ * writes so an idle follower uses no CPU. With FOLLOW_NAME, the directory
+ * of each file is watched as well, so rotated, deleted and recreated files
+ * are reopened. Only regular files are followed; this never returns while
+ * any file is followed.
+ * @param   files       Array of Follow structures (fd positioned at the end
+ * of what was already output, or -1 if not open yet)
+ * @param   nfiles      Number of files
+ * @param   mode        FOLLOW_DESCRIPTOR or FOLLOW_NAME
+ * @param   output      Pointer to Output structure
+ **/
+void follow_files(Follow *files, size_t nfiles, FollowMode mode, Output *output) {
+    int inotify = inotify_init1(IN_CLOEXEC);
+    if(inotify < 0){
+        perror("inotify_init1");
+        return;
+    }
+
+    size_t followed = 0;
+
+    // Output so far ended with the last file
+    const Follow  *current = &files[nfiles - 1];
+    const Follow **last    = nfiles > 1 ? &current : NULL;
+
+    for(size_t i = 0; i < nfiles; i++){
+        Follow *f = &files[i];
+        struct stat st;
+
+        f->wd = f->dir_wd = -1;
+
+        if(f->fd >= 0){
+            if(fstat(f->fd, &st) < 0 || !S_ISREG(st.st_mode)) continue;
+            f->dev = st.st_dev;
+            f->ino = st.st_ino;
+
+            // Descriptors (and standard input) are watched through their
+            // /proc link, which resolves to the open file even if renamed
+            char proc[BUFSIZ];
+            snprintf(proc, BUFSIZ, "/proc/self/fd/%d", f->fd);
+            f->wd = inotify_add_watch(inotify, mode == FOLLOW_NAME && f->path ? f->path : proc, FILE_EVENTS);
+        }
+
+        if(mode == FOLLOW_NAME && f->path){
+            char directory[BUFSIZ];
+            snprintf(directory, BUFSIZ, "%s", f->path);
+            f->dir_wd = inotify_add_watch(inotify, dirname(directory), DIR_EVENTS);
+        }
+
+        if(f->wd >= 0 || f->dir_wd >= 0) followed++;
+    }
+
+    // Catch up on anything appended before the watches existed
+    for(size_t i = 0; i < nfiles; i++){
+        if(mode == FOLLOW_NAME && files[i].path) follow_check(&files[i], inotify, output, last);
+        if(files[i].fd >= 0 && files[i].wd >= 0) follow_copy(&files[i], output, last);
+    }
+
+    char events[BUFSIZ] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool pending[nfiles];
+
+    while(followed){
+        ssize_t n = read(inotify, events, sizeof(events));
+        if(n < 0){
+            if(errno == EINTR) continue;
+            perror("read");
+            break;
+        }
+
+        // Collect every file touched by this batch of events, then handle
+        // each one once
+        memset(pending, 0, sizeof(pending));
+        for(char *p = events; p < events + n;){
+            const struct inotify_event *e = (const struct inotify_event *)p;
+
+            for(size_t i = 0; i < nfiles; i++){
+                Follow *f = &files[i];
+                char name[BUFSIZ];
+
+                if(e->mask & IN_Q_OVERFLOW || (f->wd >= 0 && e->wd == f->wd)){
+                    pending[i] = true;
+                }
+                else if(e->len && f->dir_wd >= 0 && e->wd == f->dir_wd){
+                    snprintf(name, BUFSIZ, "%s", f->path);
+                    if(strcmp(e->name, basename(name)) == 0) pending[i] = true;
+                }
+            }
+            p += sizeof(struct inotify_event) + e->len;
+        }
+
+        for(size_t i = 0; i < nfiles; i++){
+            if(!pending[i]) continue;
+            if(mode == FOLLOW_NAME && files[i].path) follow_check(&files[i], inotify, output, last);
+            if(files[i].fd >= 0) follow_copy(&files[i], output, last);
+        }
+    }
+
+    close(inotify);
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,224 @@
+/* scan.c: Vectorized newline scanning */
+
+#include "tailit.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/* Constants */
+
+#define SCAN_CHUNK      (1 << 24)   // Bytes counted by one thread per round
+#define SCAN_THREADS    16          // Maximum number of counting threads
+
+/* Internal Structures */
+
+typedef struct {
+    const char *s;      // Chunk of byte range
+    size_t      n;      // Length of chunk
+    size_t      count;  // Number of newlines in chunk
+} Chunk;
+
+/* Internal Functions */
+
+/**
+ * Thread: count newlines in chunk.
+ * @param   arg         Pointer to Chunk structure
+ * @return  NULL
+ **/
+static void *scan_chunk(void *arg) {
+    Chunk *c = arg;
+    c->count = scan_count(c->s, c->n);
+    return NULL;
+}
+
+/**
+ * Find the k-th newline of byte range one newline at a time.
+ * @param   s           Byte range to search
+ * @param   n           Length of byte range
+ * @param   k           Pointer to number of newlines left to find (reduced
+ * by the number found)
+ * @param   backward    Whether to count newlines from the end
+ * @return  Pointer to k-th newline or NULL if there are fewer.
+ **/
+static const char *scan_locate(const char *s, size_t n, size_t *k, bool backward) {
+    const char *p = backward ? s + n : s;
+
+    for(; *k; (*k)--){
+        const char *newline = backward ? scan_prev(s, p - s) : scan_next(p, s + n - p);
+        if(!newline) return NULL;
+        if(*k == 1) return newline;
+        p = backward ? newline : newline + 1;
+    }
+    return NULL;
+}
+
+/* Scan Functions */
+
+/**
+ * Find first newline in byte range. With SSE2 (or AVX2), 16 (or 32) bytes
+ * are compared at once and the match is located from the resulting mask.
+ * @param   s           Byte range to search
+ * @param   n           Length of byte range
+ * @return  Pointer to first newline or NULL if there is none.
+ **/
+const char *scan_next(const char *s, size_t n) {
+    size_t i = 0;
+
+#ifdef __AVX2__
+    const __m256i wide = _mm256_set1_epi8('\n');
+    for(; i + 32 <= n; i += 32){
+        __m256i  block = _mm256_loadu_si256((const __m256i *)(s + i));
+        unsigned mask  = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, wide));
+        if(mask) return s + i + __builtin_ctz(mask);
+    }
+#endif
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for(; i + 16 <= n; i += 16){
+        __m128i  block = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned mask  = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        if(mask) return s + i + __builtin_ctz(mask);
+    }
+#endif
+
+    for(; i < n; i++){
+        if(s[i] == '\n') return s + i;
+    }
+    return NULL;
+}
+
+/**
+ * Find last newline in byte range, scanning backwards.
+ * @param   s           Byte range to search
+ * @param   n           Length of byte range
+ * @return  Pointer to last newline or NULL if there is none.
+ **/
+const char *scan_prev(const char *s, size_t n) {
+    size_t i = n;
+
+#ifdef __AVX2__
+    const __m256i wide = _mm256_set1_epi8('\n');
+    for(; i >= 32; i -= 32){
+        __m256i  block = _mm256_loadu_si256((const __m256i *)(s + i - 32));
+        unsigned mask  = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, wide));
+        if(mask) return s + i - 32 + (31 - __builtin_clz(mask));
+    }
+#endif
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for(; i >= 16; i -= 16){
+        __m128i  block = _mm_loadu_si128((const __m128i *)(s + i - 16));
+        unsigned mask  = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        if(mask) return s + i - 16 + (31 - __builtin_clz(mask));
+    }
+#endif
+
+    while(i > 0){
+        if(s[--i] == '\n') return s + i;
+    }
+    return NULL;
+}
+
+/**
+ * Count newlines in byte range.
+ * @param   s           Byte range to search
+ * @param   n           Length of byte range
+ * @return  Number of newlines.
+ **/
+size_t  scan_count(const char *s, size_t n) {
+    size_t i = 0;
+    size_t count = 0;
+
+#ifdef __AVX2__
+    const __m256i wide = _mm256_set1_epi8('\n');
+    for(; i + 32 <= n; i += 32){
+        __m256i block = _mm256_loadu_si256((const __m256i *)(s + i));
+        count += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, wide)));
+    }
+#endif
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for(; i + 16 <= n; i += 16){
+        __m128i block = _mm_loadu_si128((const __m128i *)(s + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+    }
+#endif
+
+    for(; i < n; i++){
+        count += s[i] == '\n';
+    }
+    return count;
+}
+
+/**
+ * Find the k-th newline of byte range, counting from the start or from the
+ * end. The first chunk is always searched one newline at a time, so a small
+ * k reads no more than it needs. Only once a whole chunk has gone by without
+ * the k-th newline are the rest consumed in rounds of one chunk per core:
+ * the chunks of a round are counted in parallel, and a running sum of their
+ * counts shows which chunk holds the k-th newline, so only that chunk is
+ * searched one newline at a time and nothing past it is read.
+ * @param   s           Byte range to search
+ * @param   n           Length of byte range
+ * @param   k           Which newline to find (at least 1)
+ * @param   backward    Whether to count newlines from the end
+ * @return  Pointer to k-th newline or NULL if there are fewer.
+ **/
+const char *scan_nth(const char *s, size_t n, size_t k, bool backward) {
+    long   online = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t jobs   = online < 1 ? 1 : online > SCAN_THREADS ? SCAN_THREADS : online;
+    Chunk  chunks[SCAN_THREADS];
+    pthread_t threads[SCAN_THREADS];
+    bool   first  = true;
+
+    while(n > 0 && k > 0){
+        // The first chunk (or a single one) is searched directly rather
+        // than counted first
+        if(first || jobs == 1 || n <= SCAN_CHUNK){
+            first = false;
+            size_t length = n < SCAN_CHUNK ? n : SCAN_CHUNK;
+            const char *chunk = backward ? s + n - length : s;
+            const char *newline = scan_locate(chunk, length, &k, backward);
+            if(newline) return newline;
+
+            if(!backward) s += length;
+            n -= length;
+            continue;
+        }
+
+        // Split round into chunks, in the order newlines are counted
+        size_t nchunks = 0;
+        for(size_t used = 0; nchunks < jobs && used < n; nchunks++){
+            size_t length = n - used < SCAN_CHUNK ? n - used : SCAN_CHUNK;
+            used += length;
+            chunks[nchunks] = (Chunk){backward ? s + n - used : s + used - length, length, 0};
+        }
+
+        size_t started = 1;
+        for(; started < nchunks; started++){
+            if(pthread_create(&threads[started], NULL, scan_chunk, &chunks[started]) != 0) break;
+        }
+        scan_chunk(&chunks[0]);
+        for(size_t i = started; i < nchunks; i++) scan_chunk(&chunks[i]);
+        for(size_t i = 1; i < started; i++) pthread_join(threads[i], NULL);
+
+        for(size_t i = 0; i < nchunks; i++){
+            Chunk *c = &chunks[i];
+            if(c->count >= k) return scan_locate(c->s, c->n, &k, backward);
+
+            k -= c->count;
+            if(!backward) s += c->n;
+            n -= c->n;
+        }
+    }
+    return NULL;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
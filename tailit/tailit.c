@@ -1,75 +1,302 @@
 /* tailit.c: Output the last part of files */
 
-#include "list.h"
+#include "tailit.h"
 
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <string.h>
 
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define BLOCK_SIZE  (1 << 17)   // Bytes read per system call
+
 /* Functions */
 
 void usage(int status) {
-    fprintf(stderr, "Usage: tailit [-n NUMBER]\n\n");
+    fprintf(stderr, "Usage: tailit [-f | -F] [-n [+]NUMBER | -c [+]NUMBER] [FILE]...\n\n");
     fprintf(stderr, "    -n NUMBER  Output the last NUMBER of lines (default is 10)\n");
+    fprintf(stderr, "    -n +NUMBER Output lines starting with line NUMBER\n");
+    fprintf(stderr, "    -c NUMBER  Output the last NUMBER of bytes (or from byte +NUMBER)\n");
+    fprintf(stderr, "    -f         Output appended data as the file grows\n");
+    fprintf(stderr, "    -F         Like -f, but reopen FILE when it is rotated or recreated\n");
     exit(status);
 }
 
-List *tail_stream(FILE *stream, size_t limit) {
-    List *l = list_create();
-    Value v;
-    char buffer[BUFSIZ];
-    
-    while(fgets(buffer, BUFSIZ, stream)){
-        if(l->size == limit){
-            v = list_pop(l, 0);
-            free(v.string);
+/**
+ * Parse -n or -c argument: NUMBER to keep from the end, or +NUMBER to start
+ * from the beginning.
+ * @param   s           Argument string
+ * @param   bytes       Whether the argument counts bytes (-c)
+ * @param   range       Pointer to Range structure to fill
+ * @return  true if argument is a valid number.
+ **/
+bool parse_range(const char *s, bool bytes, Range *range) {
+    char *end;
+
+    range->bytes = bytes;
+    range->start = *s == '+';
+    if(*s == '+' || *s == '-') s++;
+    if(*s < '0' || *s > '9') return false;
+
+    errno = 0;
+    range->count = strtoull(s, &end, 10);
+    return errno == 0 && *end == 0;
+}
+
+/**
+ * Output header naming the file, as printed between multiple files.
+ * @param   name        File name
+ * @param   first       Whether this is the first header (no blank line)
+ * @param   output      Pointer to Output structure
+ **/
+void tail_header(const char *name, bool first, Output *output) {
+    if(!first) output_write(output, "\n", 1);
+    output_write(output, "==> ", 4);
+    output_write(output, name, strlen(name));
+    output_write(output, " <==\n", 5);
+}
+
+/**
+ * Copy part of a file to the output descriptor with sendfile, so data goes
+ * from the page cache to the destination without passing through user space
+ * (the file position is not changed).
+ * @param   fd          File descriptor to copy from
+ * @param   offset      Pointer to offset of first byte (advanced as bytes are
+ * copied)
+ * @param   end         Offset to copy up to
+ * @param   output      Pointer to Output structure (flushed first)
+ * @return  false if the destination cannot take sendfile and the rest must
+ * be copied another way.
+ **/
+bool tail_sendfile(int fd, off_t *offset, off_t end, Output *output) {
+    output_flush(output);
+
+    while(*offset < end){
+        ssize_t n = sendfile(output->fd, fd, offset, end - *offset);
+        if(n > 0) continue;
+        if(n == 0) break;
+        if(errno == EINTR) continue;
+        if(errno == EINVAL || errno == ENOSYS) return false;
+
+        perror("sendfile");
+        break;
+    }
+    return true;
+}
+
+/**
+ * Output range of a regular file through a read-only mapping of it. Lines
+ * from the end are found by scanning backwards from the end, so the work
+ * depends on the size of the output rather than the size of the file; line
+ * counts are spread over all cores (see scan_nth). Large ranges are sent
+ * straight from the page cache without being copied into a buffer.
+ * @param   fd          File descriptor of regular file
+ * @param   range       Pointer to Range structure
+ * @param   output      Pointer to Output structure
+ * @return  true on success (the file position is left at the end of what was
+ * output), false if file could not be mapped.
+ **/
+bool tail_mapped(int fd, const Range *range, Output *output) {
+    struct stat st;
+    off_t begin = lseek(fd, 0, SEEK_CUR);
+    if(begin < 0 || fstat(fd, &st) < 0) return false;
+
+    // Files such as those in /proc report no size and must be streamed
+    if(st.st_size == 0) return false;
+    if(st.st_size <= begin) return true;
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) return false;
+
+    const char *data  = map + begin;
+    size_t      n     = st.st_size - begin;
+    size_t      skip  = range->count ? range->count - 1 : 0;
+    size_t      start = n;
+
+    if(range->start){
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+        if(range->bytes){
+            start = skip < n ? skip : n;
+        }
+        else if(skip){
+            // Skip the newlines ending the lines before line count
+            const char *newline = scan_nth(data, n, skip, false);
+            start = newline ? (size_t)(newline + 1 - data) : n;
+        }
+        else{
+            start = 0;
         }
-        v.string = strdup(buffer);
-        list_append(l, v);
     }
-    
-    return l;
+    else if(range->bytes){
+        start = n > range->count ? n - range->count : 0;
+    }
+    else if(range->count){
+        // A newline ending the last line does not start another line
+        const char *newline = scan_nth(data, n - (data[n - 1] == '\n'), range->count, true);
+        start = newline ? (size_t)(newline + 1 - data) : 0;
+    }
+
+    off_t offset = begin + start;
+    if(n - start <= output->capacity || !tail_sendfile(fd, &offset, st.st_size, output)){
+        output_write(output, map + offset, st.st_size - offset);
+    }
+
+    munmap(map, st.st_size);
+    lseek(fd, st.st_size, SEEK_SET);
+    return true;
+}
+
+/**
+ * Output range of a stream, reading large blocks. Tails are kept in a window
+ * (lines of any length may span blocks); ranges starting at line or byte
+ * +NUMBER are written as soon as they begin.
+ * @param   fd          File descriptor to read
+ * @param   range       Pointer to Range structure
+ * @param   output      Pointer to Output structure
+ **/
+void tail_stream(int fd, const Range *range, Output *output) {
+    char   *block = malloc(BLOCK_SIZE);
+    size_t  skip  = range->count ? range->count - 1 : 0;
+    ssize_t nread;
+    Window  window;
+
+    if(!range->start) window_init(&window, range->count, range->bytes);
+
+    while((nread = read(fd, block, BLOCK_SIZE)) != 0){
+        if(nread < 0){
+            if(errno == EINTR) continue;
+            perror("read");
+            break;
+        }
+
+        if(!range->start){
+            window_append(&window, block, nread);
+            continue;
+        }
+
+        const char *p   = block;
+        const char *end = block + nread;
+        if(range->bytes){
+            size_t n = skip < (size_t)nread ? skip : (size_t)nread;
+            skip -= n;
+            p    += n;
+        }
+        else{
+            const char *newline;
+            for(; skip && (newline = scan_next(p, end - p)); skip--){
+                p = newline + 1;
+            }
+            if(skip) continue;
+        }
+        output_write(output, p, end - p);
+    }
+
+    if(!range->start){
+        window_output(&window, output);
+        window_delete(&window);
+    }
+    free(block);
+}
+
+/**
+ * Output range of open file: regular files are mapped, anything else (or a
+ * file that cannot be mapped) is streamed.
+ * @param   fd          File descriptor to read
+ * @param   range       Pointer to Range structure
+ * @param   output      Pointer to Output structure
+ **/
+void tail_fd(int fd, const Range *range, Output *output) {
+    struct stat st;
+    bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+
+    if(!regular || !tail_mapped(fd, range, output)){
+        tail_stream(fd, range, output);
+    }
 }
 
 /* Main Execution */
 
 int main(int argc, char *argv[]) {
     
-    size_t limit = 10;
-    List *lines;
-    Node *curr;
+    Range range = {.count = 10};
+    FollowMode mode = FOLLOW_NONE;
+    Follow *files = calloc(argc, sizeof(Follow));
+    size_t nfiles = 0;
+    int status = EXIT_SUCCESS;
+    Output output;
     
     // Parse command line arguments
-    if(argc > 3){
-        usage(1);
-    }
-    else if(argc == 2){
-        if(strcmp(argv[1], "-h") == 0){
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-h") == 0){
             usage(0);
         }
-        else{
+        else if(strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "-c") == 0){
+            if(i + 1 >= argc || !parse_range(argv[i + 1], argv[i][1] == 'c', &range)) usage(1);
+            i++;
+        }
+        else if(strncmp(argv[i], "-n", 2) == 0 || strncmp(argv[i], "-c", 2) == 0){
+            if(!parse_range(argv[i] + 2, argv[i][1] == 'c', &range)) usage(1);
+        }
+        else if(strcmp(argv[i], "-f") == 0){
+            mode = FOLLOW_DESCRIPTOR;
+        }
+        else if(strcmp(argv[i], "-F") == 0){
+            mode = FOLLOW_NAME;
+        }
+        else if(argv[i][0] == '-' && argv[i][1]){
             usage(1);
         }
+        else{
+            // "-" is standard input
+            files[nfiles++].path = strcmp(argv[i], "-") ? argv[i] : NULL;
+        }
     }
-    else if(argc == 3){
-        limit = strtol(argv[2], NULL, 10);
-    }
+    if(nfiles == 0) nfiles = 1;
     
-    // Construct tail of stream
-    lines = tail_stream(stdin, limit);
+    output_init(&output, STDOUT_FILENO, 0, '\n', NULL);
+    
+    bool first = true;
+    for(size_t i = 0; i < nfiles; i++){
+        Follow *f = &files[i];
+        
+        f->fd = f->path ? open(f->path, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+        if(f->fd < 0){
+            // With -F, a missing file is waited for
+            perror(f->path);
+            status = EXIT_FAILURE;
+            continue;
+        }
+        
+        if(nfiles > 1){
+            tail_header(follow_name(f), first, &output);
+            first = false;
+        }
+        tail_fd(f->fd, &range, &output);
+        
+        if(mode == FOLLOW_NONE && f->fd != STDIN_FILENO){
+            close(f->fd);
+            f->fd = -1;
+        }
+    }
     
-    // Print out tail
-    curr = lines->sentinel.next;
+    output_flush(&output);
     
-    while(curr != &lines->sentinel){
-        printf("%s", curr->value.string);
-        curr = curr->next;
+    // Keep following regular files for appended data
+    if(mode != FOLLOW_NONE){
+        follow_files(files, nfiles, mode, &output);
     }
     
-    list_delete(lines, true);
+    output_delete(&output);
+    free(files);
     
-    return EXIT_SUCCESS;
+    return status;
 }
 
 /* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,78 @@
+/* tailit.h: Output the last part of files */
+
+#pragma once
+
+#include "output.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* Scan Functions */
+
+const char *scan_next(const char *s, size_t n);
+const char *scan_prev(const char *s, size_t n);
+size_t  scan_count(const char *s, size_t n);
+const char *scan_nth(const char *s, size_t n, size_t k, bool backward);
+
+/* Window Structure */
+
+typedef struct {
+    char   *data;       // Circular buffer of bytes
+    size_t  capacity;   // Size of byte buffer (power of two)
+    size_t  head;       // Absolute offset of oldest byte kept
+    size_t  tail;       // Absolute offset past newest byte
+    size_t *lines;      // Circular buffer of line start offsets
+    size_t  nlines;     // Size of line buffer (power of two)
+    size_t  first;      // Absolute index of oldest line kept
+    size_t  count;      // Number of lines kept
+    size_t  limit;      // Maximum number of lines kept
+    bool    partial;    // Whether newest line is still unterminated
+    bool    bytes;      // Whether limit counts bytes instead of lines
+} Window;
+
+void    window_init(Window *w, size_t limit, bool bytes);
+void    window_append(Window *w, const char *data, size_t n);
+void    window_output(Window *w, Output *output);
+void    window_delete(Window *w);
+
+/* Range Structure */
+
+typedef struct {
+    size_t  count;      // Number of lines or bytes (-n, -c)
+    bool    bytes;      // Whether to count bytes (-c) instead of lines
+    bool    start;      // Whether count is where to start (+K) instead of
+                        // how much to keep from the end
+} Range;
+
+/* Tail Functions */
+
+void    tail_header(const char *name, bool first, Output *output);
+bool    tail_sendfile(int fd, off_t *offset, off_t end, Output *output);
+bool    tail_mapped(int fd, const Range *range, Output *output);
+void    tail_stream(int fd, const Range *range, Output *output);
+void    tail_fd(int fd, const Range *range, Output *output);
+
+/* Follow Structure */
+
+typedef enum {
+    FOLLOW_NONE,        // Output tail once
+    FOLLOW_DESCRIPTOR,  // Keep following the open file (-f)
+    FOLLOW_NAME,        // Follow the name, reopening rotated files (-F)
+} FollowMode;
+
+typedef struct {
+    const char *path;   // File name (NULL for standard input)
+    int         fd;     // Open file descriptor (-1 while missing)
+    int         wd;     // inotify watch on file (-1 if none)
+    int         dir_wd; // inotify watch on parent directory (-F)
+    dev_t       dev;    // Device of open file
+    ino_t       ino;    // Inode of open file
+} Follow;
+
+const char *follow_name(const Follow *f);
+void    follow_files(Follow *files, size_t nfiles, FollowMode mode, Output *output);
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
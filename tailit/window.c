@@ -0,0 +1,188 @@
+/* window.c: Circular window over the last lines of a stream */
+
+#include "tailit.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Constants */
+
+#define WINDOW_BYTES    (1 << 16)   // Initial size of byte ring
+#define WINDOW_LINES    64          // Initial size of line ring
+
+/* Internal Functions */
+
+/**
+ * Grow byte ring to hold at least size bytes, keeping its contents.
+ * @param   w           Pointer to Window structure
+ * @param   size        Number of bytes needed
+ **/
+static void window_reserve(Window *w, size_t size) {
+    size_t capacity = w->capacity;
+    while(capacity < size) capacity *= 2;
+    if(capacity == w->capacity) return;
+
+    // Offsets are absolute, so every byte moves to its slot in the new ring
+    char *data = malloc(capacity);
+    for(size_t o = w->head; o < w->tail;){
+        size_t from   = o & (w->capacity - 1);
+        size_t to     = o & (capacity - 1);
+        size_t length = w->tail - o;
+        if(length > w->capacity - from) length = w->capacity - from;
+        if(length > capacity - to) length = capacity - to;
+
+        memcpy(data + to, w->data + from, length);
+        o += length;
+    }
+    free(w->data);
+    w->data     = data;
+    w->capacity = capacity;
+}
+
+/**
+ * Copy bytes to the end of the byte ring (without advancing the tail).
+ * @param   w           Pointer to Window structure (with room for n bytes)
+ * @param   data        Bytes to copy
+ * @param   n           Number of bytes
+ **/
+static void window_copy(Window *w, const char *data, size_t n) {
+    size_t offset = w->tail & (w->capacity - 1);
+    size_t first  = n < w->capacity - offset ? n : w->capacity - offset;
+
+    memcpy(w->data + offset, data, first);
+    memcpy(w->data, data + first, n - first);
+}
+
+/**
+ * Start a new line, dropping the oldest line (and its bytes) if the window is
+ * full.
+ * @param   w           Pointer to Window structure
+ * @param   offset      Absolute offset of first byte of line
+ **/
+static void window_start_line(Window *w, size_t offset) {
+    if(w->count == w->limit){
+        w->first++;
+        w->count--;
+        w->head = w->count ? w->lines[w->first & (w->nlines - 1)] : offset;
+    }
+
+    if(w->count == w->nlines){
+        size_t  nlines = 2*w->nlines;
+        size_t *lines  = malloc(nlines * sizeof(size_t));
+        for(size_t i = w->first; i < w->first + w->count; i++){
+            lines[i & (nlines - 1)] = w->lines[i & (w->nlines - 1)];
+        }
+        free(w->lines);
+        w->lines  = lines;
+        w->nlines = nlines;
+    }
+
+    w->lines[(w->first + w->count) & (w->nlines - 1)] = offset;
+    w->count++;
+}
+
+/* Window Functions */
+
+/**
+ * Initialize window keeping the last limit lines (or bytes). The rings only
+ * grow until they fit the window; after that no memory is allocated.
+ * @param   w           Pointer to Window structure
+ * @param   limit       Number of lines (or bytes) to keep
+ * @param   bytes       Whether limit counts bytes rather than lines
+ **/
+void    window_init(Window *w, size_t limit, bool bytes) {
+    *w = (Window){
+        .data     = malloc(WINDOW_BYTES),
+        .capacity = WINDOW_BYTES,
+        .lines    = malloc(WINDOW_LINES * sizeof(size_t)),
+        .nlines   = WINDOW_LINES,
+        .limit    = limit,
+        .bytes    = bytes,
+    };
+}
+
+/**
+ * Append bytes of stream to window. Lines may arrive in pieces; a line ends
+ * at its newline (or at the end of the stream). In byte mode, only the last
+ * limit bytes are kept.
+ * @param   w           Pointer to Window structure
+ * @param   data        Bytes to append
+ * @param   n           Number of bytes
+ **/
+void    window_append(Window *w, const char *data, size_t n) {
+    if(w->limit == 0) return;
+
+    if(w->bytes){
+        // Only the last limit bytes of the block can matter
+        if(n > w->limit){
+            data += n - w->limit;
+            n     = w->limit;
+        }
+        window_reserve(w, w->tail - w->head + n);
+        window_copy(w, data, n);
+        w->tail += n;
+        if(w->tail - w->head > w->limit) w->head = w->tail - w->limit;
+        return;
+    }
+
+    // When this block alone starts the last limit lines, everything before
+    // them (including the whole window) is dropped without tracking each
+    // line. A newline in the final byte ends a line rather than starting one.
+    const char *start = n ? data + n - 1 : data;
+    for(size_t k = 0; k < w->limit && start; k++){
+        start = scan_prev(data, start - data);
+    }
+    if(start){
+        w->head    = w->tail;
+        w->first  += w->count;
+        w->count   = 0;
+        w->partial = false;
+        n   -= start + 1 - data;
+        data = start + 1;
+    }
+
+    // Copy the whole block at once, then record where its lines start
+    window_reserve(w, w->tail - w->head + n);
+    window_copy(w, data, n);
+
+    const char *p   = data;
+    const char *end = data + n;
+    while(p < end){
+        if(!w->partial){
+            window_start_line(w, w->tail + (p - data));
+            w->partial = true;
+        }
+
+        const char *newline = scan_next(p, end - p);
+        if(!newline) break;
+
+        w->partial = false;
+        p = newline + 1;
+    }
+    w->tail += n;
+}
+
+/**
+ * Output contents of window (at most two contiguous pieces).
+ * @param   w           Pointer to Window structure
+ * @param   output      Pointer to Output structure
+ **/
+void    window_output(Window *w, Output *output) {
+    size_t begin = w->head & (w->capacity - 1);
+    size_t size  = w->tail - w->head;
+    size_t first = size < w->capacity - begin ? size : w->capacity - begin;
+
+    output_write(output, w->data + begin, first);
+    output_write(output, w->data, size - first);
+}
+
+/**
+ * Deallocate window.
+ * @param   w           Pointer to Window structure
+ **/
+void    window_delete(Window *w) {
+    free(w->data);
+    free(w->lines);
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */